@@ -0,0 +1,199 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-12
+@Detail    : http压测客户端，每个线程用epoll驱动若干长连接，每个连接收到完整响应后再发送下一个请求，
+             输出每秒完成的请求数。用于比较epoll和io_uring后端，见uring_vs_epoll.sh
+@Reference : https://github.com/wg/wrk
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+using namespace std;
+
+/* 一个长连接的状态 */
+struct Client{
+    int _fd;
+    int _left;          /* 还要发送的请求数 */
+    string _recv;       /* 已收到、还不完整的响应 */
+};
+
+/* 一个压测线程的参数和结果 */
+struct Worker{
+    pthread_t _thread;
+    int _connNum;       /* 本线程的连接数 */
+    long _done;         /* 完成的请求数 */
+    long _bad;          /* 出错的请求数 */
+};
+
+static sockaddr_in g_addr;
+static int g_requests = 0;       /* 每个连接的请求数 */
+static string g_request;         /* 请求报文 */
+static pthread_barrier_t g_ready; /* 所有连接建立后才开始计时和发送，握手不计入结果 */
+
+/*
+*功能：建立连接，失败返回-1
+*/
+static int connectServer(){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+    if(connect(fd, (sockaddr*)&g_addr, sizeof(g_addr)) != 0){
+        close(fd);
+        return -1;
+    }
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    return fd;
+}
+
+/*
+*功能：_recv中是否已有一个完整的响应，有则取走
+*返回值：1: 取走了一个200响应；-1: 取走了一个非200响应；0: 响应不完整
+*/
+static int takeResponse(Client* client){
+    size_t end = client->_recv.find("\r\n\r\n");
+    if(end == string::npos){
+        return 0;
+    }
+    size_t pos = client->_recv.find("Content-Length:");
+    int contentLen = 0;
+    if(pos != string::npos && pos < end){
+        contentLen = atoi(client->_recv.c_str() + pos + strlen("Content-Length:"));
+    }
+    size_t total = end + 4 + contentLen;
+    if(client->_recv.size() < total){
+        return 0;
+    }
+    bool ok = client->_recv.compare(0, 12, "HTTP/1.1 200") == 0;
+    client->_recv.erase(0, total);
+    return ok ? 1 : -1;
+}
+
+/*
+*功能：压测线程，所有线程的连接都建立后同时发出第一个请求，之后每收到一个完整响应再发送下一个
+*/
+static void* run(void* arg){
+    Worker* worker = (Worker*)arg;
+    int epollFd = epoll_create(1);
+    Client* clients = new Client[worker->_connNum];
+    int active = 0;
+    for(int i=0; i<worker->_connNum; ++i){
+        Client* client = clients + i;
+        client->_fd = connectServer();
+        client->_left = g_requests;
+        if(client->_fd < 0){
+            worker->_bad += g_requests;
+            continue;
+        }
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, client->_fd, &event);
+    }
+    pthread_barrier_wait(&g_ready);
+    for(int i=0; i<worker->_connNum; ++i){
+        Client* client = clients + i;
+        if(client->_fd < 0){
+            continue;
+        }
+        send(client->_fd, g_request.data(), g_request.size(), MSG_NOSIGNAL);
+        client->_left--;
+        ++active;
+    }
+
+    epoll_event events[256];
+    char buf[16384];
+    while(active > 0){
+        int num = epoll_wait(epollFd, events, 256, 5000);
+        if(num <= 0){
+            /* 5秒没有响应，放弃剩下的请求 */
+            break;
+        }
+        for(int i=0; i<num; ++i){
+            Client* client = (Client*)events[i].data.ptr;
+            int len = recv(client->_fd, buf, sizeof(buf), 0);
+            if(len <= 0){
+                worker->_bad += client->_left + 1;
+                close(client->_fd);
+                --active;
+                continue;
+            }
+            client->_recv.append(buf, len);
+            int ret;
+            while((ret = takeResponse(client)) != 0){
+                if(ret > 0){
+                    worker->_done++;
+                }
+                else{
+                    worker->_bad++;
+                }
+                if(client->_left == 0){
+                    close(client->_fd);
+                    --active;
+                    break;
+                }
+                send(client->_fd, g_request.data(), g_request.size(), MSG_NOSIGNAL);
+                client->_left--;
+            }
+        }
+    }
+    delete[] clients;
+    close(epollFd);
+    return NULL;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 6){
+        printf("usage: %s ip port threads connections requests [path]\n", argv[0]);
+        printf("       connections为所有线程的连接总数，requests为每个连接的请求数\n");
+        return 1;
+    }
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[1], &g_addr.sin_addr);
+    g_addr.sin_port = htons(atoi(argv[2]));
+    int threadNum = atoi(argv[3]);
+    int connNum = atoi(argv[4]);
+    g_requests = atoi(argv[5]);
+    const char* path = argc > 6 ? argv[6] : "/";
+    g_request = string("GET ") + path + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+    if(threadNum <= 0 || connNum < threadNum || g_requests <= 0){
+        printf("%s\n", "bad arguments");
+        return 1;
+    }
+
+    Worker* workers = new Worker[threadNum];
+    pthread_barrier_init(&g_ready, NULL, threadNum + 1);
+    for(int i=0; i<threadNum; ++i){
+        workers[i]._connNum = connNum / threadNum + (i < connNum % threadNum ? 1 : 0);
+        workers[i]._done = 0;
+        workers[i]._bad = 0;
+        pthread_create(&workers[i]._thread, NULL, run, workers + i);
+    }
+    timespec begin, end;
+    pthread_barrier_wait(&g_ready);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    long done = 0, bad = 0;
+    for(int i=0; i<threadNum; ++i){
+        pthread_join(workers[i]._thread, NULL);
+        done += workers[i]._done;
+        bad += workers[i]._bad;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("requests %ld, errors %ld, %.3f s, %.0f requests/sec\n", done, bad, seconds, done / seconds);
+    pthread_barrier_destroy(&g_ready);
+    delete[] workers;
+    return bad == 0 ? 0 : 2;
+}
@@ -0,0 +1,107 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-27
+@Detail    : 请求报文解析的微基准，用同一个连接反复解析一个浏览器请求和一个curl请求，
+             对Scanner的每个实现分别输出每秒解析的请求数，取3次中最好的一次。
+             只测量HttpConn::parse()，不涉及网络和数据库
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../source/http/httpconn.h"
+#include "../source/http/scanner.h"
+
+/* Chrome访问图片页的请求，头部较多且行较长 */
+static const char g_chrome[] =
+    "GET /picture.html HTTP/1.1\r\n"
+    "Host: 192.168.1.20:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"104\", \" Not A;Brand\";v=\"99\", \"Google Chrome\";v=\"104\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/104.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+    "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.9\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Referer: http://192.168.1.20:9006/welcome.html\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.123456789.1660000000; sid=4eac298def85d5c00e204d4bcb6298f8\r\n"
+    "\r\n";
+
+/* curl的默认请求，只有几个很短的头部 */
+static const char g_curl[] =
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: localhost:9006\r\n"
+    "User-Agent: curl/7.81.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+/* HttpConn的友元，可以重置连接 */
+class ParseBench{
+public:
+    ParseBench(){
+        _conn._closeLog = 1;
+    }
+    /*
+    *功能：反复解析同一个请求
+    *参数：
+    *      --req: 请求报文
+    *      --len: 报文长度
+    *      --times: 解析次数
+    *返回值：每秒解析的请求数，解析失败返回0
+    */
+    double run(const char* req, int len, long times){
+        timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for(long i=0; i<times; ++i){
+            _conn.init();
+            _conn.readFrom(req, len);
+            if(_conn.parse() != HttpConn::GET_REQUEST){
+                return 0;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        return times / ((end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9);
+    }
+
+private:
+    HttpConn _conn;
+};
+
+int main(int argc, char* argv[]){
+    long times = argc > 1 ? atol(argv[1]) : 2000000;
+    const char* impls[] = {"scalar", "sse2", "avx2"};
+    const char* names[] = {"chrome", "curl"};
+    const char* reqs[] = {g_chrome, g_curl};
+    int lens[] = {(int)sizeof(g_chrome) - 1, (int)sizeof(g_curl) - 1};
+
+    ParseBench bench;
+    printf("%-8s %-12s %s\n", "scanner", "request", "M parses/s");
+    for(int i=0; i<3; ++i){
+        if(!Scanner::use(impls[i])){
+            printf("%-8s %s\n", impls[i], "not supported");
+            continue;
+        }
+        for(int j=0; j<2; ++j){
+            double best = 0;
+            for(int k=0; k<3; ++k){
+                double rate = bench.run(reqs[j], lens[j], times);
+                if(rate == 0){
+                    printf("%s\n", "parse failed");
+                    return 1;
+                }
+                best = rate > best ? rate : best;
+            }
+            printf("%-8s %-6s%4dB  %.2f\n", impls[i], names[j], lens[j], best / 1e6);
+        }
+    }
+    return 0;
+}
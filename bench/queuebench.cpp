@@ -0,0 +1,183 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-5
+@Detail    : 线程池请求队列的微基准：原来的list+互斥锁+信号量，无锁环形队列+事件计数(空队列时立即休眠)，
+             以及线程池现在的做法(空队列时先让出CPU重试SPIN_BEFORE_WAIT次再休眠)。
+             n个生产者和n个消费者，生产者入队，消费者出队，输出每秒完成的入队出队对数(百万)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <list>
+#include "../source/locker/locker.h"
+#include "../source/locker/lockfreequeue.h"
+using namespace std;
+
+static const int QUEUE_SIZE = 16384;   /* 和线程池默认的maxRequests 10000对应 */
+static int g_items = 2000000;          /* 每轮的元素总数 */
+static int g_dummy = 0;                /* 元素都指向它，NULL用于通知消费者退出 */
+
+/* 修改线程池前的请求队列 */
+class ListQueue{
+public:
+    bool push(int* item){
+        _locker.lock();
+        if(_list.size() >= (size_t)QUEUE_SIZE){
+            _locker.unlock();
+            return false;
+        }
+        _list.push_back(item);
+        _locker.unlock();
+        _sem.post();
+        return true;
+    }
+
+    int* pop(){
+        while(true){
+            _sem.wait();
+            _locker.lock();
+            if(_list.empty()){
+                _locker.unlock();
+                continue;
+            }
+            int* item = _list.front();
+            _list.pop_front();
+            _locker.unlock();
+            return item;
+        }
+    }
+
+private:
+    list<int*> _list;
+    Locker _locker;
+    Sem _sem;
+};
+
+/* 线程池现在的请求队列，入队出队和ThreadPool::push、ThreadPool::pop相同。
+   SPIN为队列为空时让出CPU重试的次数，1表示不重试，直接登记后休眠 */
+template<int SPIN>
+class RingQueue{
+public:
+    RingQueue():_queue(QUEUE_SIZE){}
+
+    bool push(int* item){
+        if(!_queue.push(item)){
+            return false;
+        }
+        _notEmpty.notify();
+        return true;
+    }
+
+    int* pop(){
+        int* item;
+        int spins = 0;
+        while(true){
+            if(_queue.pop(item)){
+                return item;
+            }
+            if(++spins < SPIN){
+                sched_yield();
+                continue;
+            }
+            spins = 0;
+            uint32_t key = _notEmpty.prepareWait();
+            if(_queue.pop(item)){
+                _notEmpty.cancelWait();
+                return item;
+            }
+            _notEmpty.wait(key);
+        }
+    }
+
+private:
+    LockFreeQueue<int*> _queue;
+    EventCount _notEmpty;
+};
+
+template<class Q>
+struct Bench{
+    Q _queue;
+    int _perProducer;
+};
+
+template<class Q>
+static void* produce(void* arg){
+    Bench<Q>* bench = (Bench<Q>*)arg;
+    for(int i=0; i<bench->_perProducer; ++i){
+        /* 队列满时让出CPU，线程池中对应的是返回503 */
+        while(!bench->_queue.push(&g_dummy)){
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+template<class Q>
+static void* consume(void* arg){
+    Bench<Q>* bench = (Bench<Q>*)arg;
+    while(bench->_queue.pop() != NULL){
+    }
+    return NULL;
+}
+
+/*
+*功能：运行一轮
+*参数：
+*      --threads: 生产者和消费者各自的数量
+*返回值：每秒完成的入队出队对数(百万)
+*/
+template<class Q>
+static double run(int threads){
+    Bench<Q>* bench = new Bench<Q>;
+    bench->_perProducer = g_items / threads;
+    pthread_t* producers = new pthread_t[threads];
+    pthread_t* consumers = new pthread_t[threads];
+    timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for(int i=0; i<threads; ++i){
+        pthread_create(consumers + i, NULL, consume<Q>, bench);
+        pthread_create(producers + i, NULL, produce<Q>, bench);
+    }
+    for(int i=0; i<threads; ++i){
+        pthread_join(producers[i], NULL);
+    }
+    /* 每个消费者一个NULL，取完所有元素后退出 */
+    for(int i=0; i<threads; ++i){
+        while(!bench->_queue.push(NULL)){
+            sched_yield();
+        }
+    }
+    for(int i=0; i<threads; ++i){
+        pthread_join(consumers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    double mops = (double)bench->_perProducer * threads / seconds / 1e6;
+    delete[] producers;
+    delete[] consumers;
+    delete bench;
+    return mops;
+}
+
+int main(int argc, char* argv[]){
+    if(argc > 1){
+        g_items = atoi(argv[1]);
+    }
+    printf("%d items, n producers + n consumers, Mops/s (best of 3)\n", g_items);
+    printf("%8s %16s %22s %16s\n", "n", "list+mutex+sem", "lockfree+eventcount", "spin then wait");
+    for(int threads=1; threads<=64; threads*=2){
+        double list = 0, ring = 0, spin = 0;
+        for(int i=0; i<3; ++i){
+            double mops = run<ListQueue>(threads);
+            list = mops > list ? mops : list;
+            mops = run<RingQueue<1> >(threads);
+            ring = mops > ring ? mops : ring;
+            mops = run<RingQueue<16> >(threads);
+            spin = mops > spin ? mops : spin;
+        }
+        printf("%8d %16.2f %22.2f %16.2f\n", threads, list, ring, spin);
+    }
+    return 0;
+}
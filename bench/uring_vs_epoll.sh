@@ -0,0 +1,20 @@
+#!/bin/bash
+# epoll和io_uring后端的吞吐对比
+# 用法：在项目根目录执行 make server httpload && ./bench/uring_vs_epoll.sh [连接数] [每个连接的请求数] [额外的server参数]
+# server启动时要连接main.cpp里配置的MySQL，静态页面从./root读取
+
+PORT=${PORT:-9113}
+CONNS=${1:-50}
+REQUESTS=${2:-1000}
+EXTRA=${3:-"-r 1 -t 4"}
+
+for uring in 0 1; do
+    ./server -p $PORT -c 1 -u $uring $EXTRA > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    echo "-u $uring $EXTRA, $CONNS connections x $REQUESTS requests"
+    ./httpload 127.0.0.1 $PORT 2 $CONNS $REQUESTS
+    kill $pid
+    wait $pid 2>/dev/null
+    sleep 1
+done
@@ -0,0 +1,167 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-16
+@Detail    : 缓冲区池，连接只在处理请求期间借用读写缓冲区，空闲时归还
+@Reference : https://www.kernel.org/doc/gorman/html/understand/understand011.html
+*/
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <list>
+#include "../locker/locker.h"
+using namespace std;
+
+/* 缓冲区池类：每次向系统申请一个slab(SLAB_SIZE个块)，空闲的块串成链表。
+   每个线程有自己的空闲链表，借出和归还只操作本线程的链表，不加锁；本线程的链表空了，
+   加锁从全局链表一次取BATCH_SIZE个，超过2*BATCH_SIZE个时一次还回BATCH_SIZE个。
+   缓冲区常由事件循环借出、工作线程归还，批量归还让块回到全局链表中被其他线程使用。
+   块不归还给系统，数量等于同时处理的请求数的峰值加上各线程缓存的块 */
+template<class T>
+class BufferPool{
+public:
+    static BufferPool* getInstance();
+    T* acquire();
+    void release(T* buf);
+
+private:
+    BufferPool();
+    ~BufferPool();
+
+    /* 空闲时块的开头存放下一个空闲块的地址 */
+    union Block{
+        Block* _next;
+        T _buf;
+    };
+    /* 线程的空闲链表，线程退出时还回全局链表 */
+    struct Cache{
+        Cache():_head(NULL), _count(0){}
+        ~Cache(){
+            if(_count > 0){
+                BufferPool::getInstance()->giveBack(this, _count);
+            }
+        }
+        Block* _head;
+        int _count;
+    };
+    static const int SLAB_SIZE = 64;  /* 每个slab中块的数量 */
+    static const int BATCH_SIZE = 16; /* 线程和全局链表之间一次移动的块数 */
+
+    static Cache* cache();
+    void refill(Cache* cache);
+    void giveBack(Cache* cache, int num);
+
+    Block* _freeList;        /* 全局空闲块链表 */
+    list<Block*> _slabs;     /* 已申请的slab, 析构时释放 */
+    Locker _locker;          /* 互斥锁，保护全局链表 */
+};
+
+template<class T>
+BufferPool<T>::BufferPool(){
+    _freeList = NULL;
+}
+
+template<class T>
+BufferPool<T>::~BufferPool(){
+    for(typename list<Block*>::iterator it = _slabs.begin(); it != _slabs.end(); ++it){
+        delete[] *it;
+    }
+}
+
+/*
+* 功能：单例模式，每种缓冲区全局只有一个池
+*/
+template<class T>
+BufferPool<T>* BufferPool<T>::getInstance(){
+    static BufferPool pool;
+    return &pool;
+}
+
+/*
+* 功能：当前线程的空闲链表
+*/
+template<class T>
+typename BufferPool<T>::Cache* BufferPool<T>::cache(){
+    static thread_local Cache local;
+    return &local;
+}
+
+/*
+* 功能：从全局链表取BATCH_SIZE个块放入线程的链表，全局链表不够则先申请一个新的slab
+* 参数：
+*       --cache: 线程的空闲链表，调用时为空
+*/
+template<class T>
+void BufferPool<T>::refill(Cache* cache){
+    _locker.lock();
+    for(int i=0; i<BATCH_SIZE; ++i){
+        if(_freeList == NULL){
+            Block* slab = new Block[SLAB_SIZE];
+            _slabs.push_back(slab);
+            for(int j=0; j<SLAB_SIZE; ++j){
+                slab[j]._next = _freeList;
+                _freeList = slab + j;
+            }
+        }
+        Block* block = _freeList;
+        _freeList = block->_next;
+        block->_next = cache->_head;
+        cache->_head = block;
+    }
+    _locker.unlock();
+    cache->_count += BATCH_SIZE;
+}
+
+/*
+* 功能：将线程链表开头的num个块还回全局链表
+* 参数：
+*       --cache: 线程的空闲链表
+*       --num: 归还的块数，不超过链表长度
+*/
+template<class T>
+void BufferPool<T>::giveBack(Cache* cache, int num){
+    Block* first = cache->_head;
+    Block* last = first;
+    for(int i=1; i<num; ++i){
+        last = last->_next;
+    }
+    cache->_head = last->_next;
+    cache->_count -= num;
+    _locker.lock();
+    last->_next = _freeList;
+    _freeList = first;
+    _locker.unlock();
+}
+
+/*
+* 功能：借出一个缓冲区。缓冲区的内容不清零
+*/
+template<class T>
+T* BufferPool<T>::acquire(){
+    Cache* local = cache();
+    if(local->_head == NULL){
+        refill(local);
+    }
+    Block* block = local->_head;
+    local->_head = block->_next;
+    --local->_count;
+    return &block->_buf;
+}
+
+/*
+* 功能：归还缓冲区
+* 参数：
+*       --buf: acquire借出的缓冲区
+*/
+template<class T>
+void BufferPool<T>::release(T* buf){
+    Block* block = (Block*)buf;
+    Cache* local = cache();
+    block->_next = local->_head;
+    local->_head = block;
+    if(++local->_count > 2 * BATCH_SIZE){
+        giveBack(local, BATCH_SIZE);
+    }
+}
+
+#endif
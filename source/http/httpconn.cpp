@@ -1,6 +1,7 @@
 #include "httpconn.h"
+#include "../server/eventloop.h"
+#include "scanner.h"
 #include <iostream>
-Locker _locker;
 
 const char* ok_200_title = "OK";
 const char* error_400_title = "Bad Request";
@@ -11,43 +12,57 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+/* 过载时直接发送的完整响应，不经过线程池 */
+const char busy_503_response[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 44\r\nConnection: close\r\nRetry-After: 1\r\n\r\nThe server is busy, please try again later.\n";
 
-int HttpConn::_epollFd = -1;  /* epoll的文件描述符 */
-int HttpConn::_userCount = 0; /* 已连接的客户数量 */
+atomic<int> HttpConn::_userCount(0); /* 已连接的客户数量 */
 
-map<string,string> _users;   /* sql中的用户 */
+
+/*
+*功能：连接对象随注册表一次性创建，在init()之前定时器回调、unmap()等就可能读取成员，全部给出确定的初值
+*/
+HttpConn::HttpConn():_mysql(NULL), _state(0), _sockFd(-1), _gen(0), _epollFd(-1), _loop(NULL), _address(),
+    _trigMode(0), _root(NULL), _closeLog(0), _bytesToSend(0), _bytesHaveSend(0), _checkState(REQUESTLINE),
+    _linger(false), _method(GET), _url(NULL), _version(NULL), _host(NULL), _contentLen(0), _cgi(0),
+    _sqlResult(-1), _content(NULL), _cookie(NULL), _session(-1), _token(), _buf(NULL), _writeBuf(NULL),
+    _writeIdx(0), _readBuf(NULL), _readIdx(0), _checkedIdx(0), _startLine(0), _fileStat(), _realFile(NULL),
+    _fileAddress(NULL), _iv(), _ivCount(0){
+}
 
 /*
 *功能：初始化连接, 并将连接加入epoll中
 *参数：
 *    --sockFd: 连接的文件描述符
+*    --gen: 连接的代数
 *    --addr: 客户端地址
+*    --loop: 连接所属的事件循环
 *    --root: 文件路径
 *    --trigMode: 触发模式
 *    --closeLog: 日志文件关闭模式
-*    --user，password, database: sql参数
 */
-void HttpConn::init(int sockFd, const sockaddr_in& addr, char* root, int trigMode,
-    int closeLog, string user, string password, string database){
+void HttpConn::init(int sockFd, unsigned gen, const sockaddr_in& addr, EventLoop* loop, char* root, int trigMode,
+    int closeLog){
     _sockFd = sockFd;
+    _gen = gen;
     _address = addr;
+    _loop = loop;
+    _epollFd = loop->_epollFd;
  
     /* 当浏览器出现连接重置时 */
     _root = root;
     _trigMode = trigMode;
     _closeLog = closeLog;
-    strcpy(_sqlUser, user.c_str());
-    strcpy(_sqlPassword, password.c_str());
-    strcpy(_sqlDatabase, database.c_str());
 
-    /* 将连接加入epoll监听中 */
-    addFd(_epollFd, _sockFd, true, _trigMode);
+    /* 将连接加入epoll监听中，io_uring后端由事件循环提交接收请求 */
+    if(_epollFd != -1){
+        addFd(_epollFd, _sockFd, true, _trigMode);
+    }
     _userCount++;
     init();
 }
 
 /*
-*功能：初始化连接
+*功能：初始化连接，上一个请求已经处理完，归还缓冲区。读写缓冲区都按下标访问，不需要清零
 */
 void HttpConn::init(){
     _mysql = NULL;
@@ -65,13 +80,41 @@ void HttpConn::init(){
     _readIdx = 0;
     _writeIdx = 0;
     _cgi = 0;
+    _content = NULL;
+    _sqlResult = -1;
+    _cookie = NULL;
+    _session = -1;
+    _token[0] = '\0';
     _state = 0;
-    _timerFlag = 0;
-    _improv = 0;
+    releaseBuffer();
+}
 
-    memset(_readBuf, '\0', READ_BUFFER_SIZE);
-    memset(_writeBuf, '\0', WRITE_BUFFER_SIZE);
-    memset(_realFile, '\0', FILENAME_LEN);
+/*
+*功能：开始接收请求时从缓冲区池借用缓冲区
+*/
+void HttpConn::acquireBuffer(){
+    if(_buf){
+        return;
+    }
+    _buf = BufferPool<Buffer>::getInstance()->acquire();
+    _readBuf = _buf->_readBuf;
+    _writeBuf = _buf->_writeBuf;
+    _realFile = _buf->_realFile;
+}
+
+/*
+*功能：归还缓冲区。连接被关闭时缓冲区留到fd被新连接使用、init()时再归还，
+*     避免和可能仍在处理该连接的工作线程冲突
+*/
+void HttpConn::releaseBuffer(){
+    if(!_buf){
+        return;
+    }
+    BufferPool<Buffer>::getInstance()->release(_buf);
+    _buf = NULL;
+    _readBuf = NULL;
+    _writeBuf = NULL;
+    _realFile = NULL;
 }
 
 /*
@@ -84,7 +127,7 @@ void HttpConn::init(){
 */
 void HttpConn::addFd(int epollFd, int sockFd, bool oneShot, int trigMode){
     epoll_event event;
-    event.data.fd = sockFd;
+    event.data.u64 = ((uint64_t)_gen << 32) | (uint32_t)sockFd;
 
     if(1 == trigMode){
         event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -133,7 +176,7 @@ void HttpConn::removeFd(int epollFd, int fd){
 */
 void HttpConn::modFd(int epollFd, int fd, int ev, int trigMode){
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = ((uint64_t)_gen << 32) | (uint32_t)fd;
     if(1 == trigMode){
         event.events = ev | EPOLLET | EPOLLRDHUP;
     }
@@ -144,6 +187,23 @@ void HttpConn::modFd(int epollFd, int fd, int ev, int trigMode){
     epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
 }
 
+/*
+*  功能：本次处理结束，连接接下来等待ev事件。
+*       工作线程将事件交回事件循环，由事件循环重置EPOLLONESHOT或提交请求，连接在交回之前不会被关闭；
+*       epoll后端的Proactor模式由事件循环自己发送响应，直接重置EPOLLONESHOT。
+*       关闭连接总是交给事件循环，由它同时删除定时器
+*  参数：
+*        --ev: 等待的事件，EPOLLIN或EPOLLOUT；0表示处理失败，连接需要关闭
+*/
+void HttpConn::rearm(int ev){
+    if(0 != ev && _epollFd != -1 && _loop->inLoop()){
+        modFd(_epollFd, _sockFd, ev, _trigMode);
+    }
+    else if(_sockFd != -1){
+        _loop->postEvent(_sockFd, _gen, ev);
+    }
+}
+
 /*
 *功能: 读取客户发送的数据
 *返回值：是否读取成功
@@ -152,6 +212,7 @@ bool HttpConn::readOnce(){
     
     /* 读缓冲区已满 */
     if(_readIdx >= READ_BUFFER_SIZE) return false;
+    acquireBuffer();
     
     int bytesRead = 0;
 
@@ -188,6 +249,30 @@ bool HttpConn::readOnce(){
     return true;
 }
 
+/*
+*功能: 请求队列已满，不处理请求，直接发送503响应，随后由事件循环关闭连接
+*/
+void HttpConn::sendBusy(){
+    send(_sockFd, busy_503_response, sizeof(busy_503_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/*
+*功能: 将事件循环已经接收的数据放入读缓冲区，io_uring后端使用
+*参数：
+*    --data: 数据首地址
+*    --len: 数据长度
+*返回值：放入的字节数，读缓冲区满了则小于len
+*/
+int HttpConn::readFrom(const char* data, int len){
+    acquireBuffer();
+    if(len > READ_BUFFER_SIZE - _readIdx){
+        len = READ_BUFFER_SIZE - _readIdx;
+    }
+    memcpy(_readBuf + _readIdx, data, len);
+    _readIdx += len;
+    return len;
+}
+
 /*
 *功能: EPOLLOUT被触发，将内核写缓冲区由满变为未满，将用户写缓冲区的数据发送出去
 *返回值：true: 连接继续存在；FALSE： 连接需要被关闭
@@ -196,8 +281,8 @@ bool HttpConn::write(){
     int tmp = 0;
     if(_bytesToSend == 0){
         /* 待发送字节数为0，则响应结束，重置socket */
-        modFd(_epollFd, _sockFd, EPOLLIN, _trigMode);
         init();
+        rearm(EPOLLIN);
         return true;
     }
     while(true){
@@ -206,7 +291,7 @@ bool HttpConn::write(){
         if(tmp < 0){
             /* 写缓冲区满了，则重新注册EPOLLOUT事件，重置EPOLLONESHOT */
             if(errno == EAGAIN){
-                modFd(_epollFd, _sockFd, EPOLLOUT, _trigMode);
+                rearm(EPOLLOUT);
                 return true;
             }
             /* 发送失败，取消内存映射 */
@@ -214,29 +299,15 @@ bool HttpConn::write(){
             return false;
         }
 
-        _bytesHaveSend += tmp;
-        _bytesToSend -= tmp;
-        /* 如果把iv[0]里的内容发送完了， 更新下次发送也就是iv[1]的起始地址和长度 */
-        if(_bytesHaveSend >= _iv[0].iov_len){
-            _iv[0].iov_len = 0;
-            _iv[1].iov_base = _fileAddress + (_bytesHaveSend - _writeIdx);
-            _iv[1].iov_len = _bytesToSend;
-        }
-        else{
-            /* iv[0]没有发送完 */
-            _iv[0].iov_base = _writeBuf+_bytesHaveSend;
-            _iv[0].iov_len = _iv[0].iov_len - _bytesHaveSend;
-        }
-
         /* 没有数据发送了 */
-        if(_bytesToSend <= 0){
+        if(sent(tmp)){
             unmap();
-            /* 不再注册EPOLLOUT, 重置EPOLLONESHOT */
-            modFd(_epollFd, _sockFd, EPOLLIN, _trigMode);
             /* 如果保持连接 */
             if(_linger){
                 /* 本次请求结束，重新初始化http对象 */
                 init();
+                /* 不再注册EPOLLOUT, 重置EPOLLONESHOT。之后连接交给事件循环，不能再访问 */
+                rearm(EPOLLIN);
                 return true;
             }
             else{
@@ -246,6 +317,41 @@ bool HttpConn::write(){
     }
 }
 
+/*
+*功能: 已经发送了bytes字节，更新_iv中下次发送的起始地址和长度
+*参数：bytes: 本次发送的字节数
+*返回值：响应是否已全部发送
+*/
+bool HttpConn::sent(int bytes){
+    _bytesHaveSend += bytes;
+    _bytesToSend -= bytes;
+    /* 如果把iv[0]里的内容发送完了， 更新下次发送也就是iv[1]的起始地址和长度 */
+    if(_bytesHaveSend >= _writeIdx){
+        _iv[0].iov_len = 0;
+        _iv[1].iov_base = _fileAddress + (_bytesHaveSend - _writeIdx);
+        _iv[1].iov_len = _bytesToSend;
+    }
+    else{
+        /* iv[0]没有发送完 */
+        _iv[0].iov_base = _writeBuf+_bytesHaveSend;
+        _iv[0].iov_len = _writeIdx - _bytesHaveSend;
+    }
+    return _bytesToSend <= 0;
+}
+
+/*
+*功能: 响应发送完毕，io_uring后端使用。保持连接则重新初始化http对象
+*返回值：true: 连接继续存在；FALSE： 连接需要被关闭
+*/
+bool HttpConn::finishResponse(){
+    unmap();
+    if(_linger){
+        init();
+        return true;
+    }
+    return false;
+}
+
 /*
 *功能: 取消资源文件的内存映射
 */
@@ -260,21 +366,137 @@ void HttpConn::unmap(){
 *功能: 读取数据后，处理客户端的请求，并将响应报文写入用户缓冲区，准备发送
 */
 void HttpConn::process(){
+    rearm(prepare());
+}
+
+/*
+*功能: 处理客户端的请求，将响应报文写入用户缓冲区，但不重置事件。
+*     run-to-completion模式下工作线程随后直接调用write()发送
+*返回值：连接接下来等待的事件，EPOLLIN: 请求不完整；EPOLLOUT: 响应已准备好；0: 处理失败
+*/
+int HttpConn::prepare(){
     /* 解析http请求 */
-    HTTP_CODE readRet = processRead();
+    return respond(parse());
+}
+
+/*
+*功能: 解析读缓冲区中的请求，不处理请求
+*返回值：NO_REQUEST: 请求不完整；GET_REQUEST: 请求完整，交给respond()处理；其他为出错的状态码
+*/
+HttpConn::HTTP_CODE HttpConn::parse(){
+    return processRead();
+}
+
+/*
+*功能: 处理parse()解析出的请求，将响应报文写入用户缓冲区
+*参数：
+*    --readRet: parse()的返回值
+*返回值：同prepare()
+*/
+int HttpConn::respond(HTTP_CODE readRet){
     if(readRet == NO_REQUEST){
-        /* 客户端没有请求, 响应结束，重置EPOLLONESHOT */
-        modFd(_epollFd, _sockFd, EPOLLIN, _trigMode);
-        return;
+        /* 客户端没有请求, 继续监测读事件 */
+        return EPOLLIN;
+    }
+    if(readRet == GET_REQUEST){
+        /* 请求完整，处理请求 */
+        readRet = doRequest();
     }
     /* 有请求，则根据请求将响应报文写入用户缓冲区，之后再一次发送，减少调用 */
     bool writeRet = processWrite(readRet);
     if(!writeRet){
-        /* 向写缓冲区写入失败 */
-        closeConn();
+        /* 向写缓冲区写入失败，关闭连接 */
+        return 0;
     }
-    /* 用户写缓冲有数据待发送，注册EPOLLOUT，重置EPOLLONESHOT */
-    modFd(_epollFd, _sockFd, EPOLLOUT, _trigMode);
+    /* 用户写缓冲有数据待发送，注册EPOLLOUT */
+    return EPOLLOUT;
+}
+
+/*
+*功能: parse()得到完整的请求后，判断处理它是否需要访问数据库(登录和注册)
+*/
+bool HttpConn::needDatabase(){
+    const char* p = strchr(_url, '/');
+    if(_cgi != 1 || p == NULL){
+        return false;
+    }
+    /* 带有效令牌的登录不访问用户表 */
+    return *(p+1) == '3' || (*(p+1) == '2' && !hasSession());
+}
+
+/*
+*功能: 请求的Cookie中是否带有有效的会话令牌，有效则会话重新计时。每个请求只检查一次。
+*     请求提交了表单时令牌必须属于表单中的用户，换一个用户名登录要比较密码；
+*     表单格式不对时不使用令牌，由doRequest返回登录失败
+*/
+bool HttpConn::hasSession(){
+    if(_session < 0){
+        char name[USER_FIELD_LEN], password[USER_FIELD_LEN];
+        if(_content && *_content){
+            _session = (getUser(name, password) && SessionTable::getInstance()->touch(_cookie, name)) ? 1 : 0;
+        }
+        else{
+            _session = SessionTable::getInstance()->touch(_cookie) ? 1 : 0;
+        }
+    }
+    return 1 == _session;
+}
+
+/*
+*功能: needDatabase()的请求为注册且事件循环有异步数据库客户端时，将插入交给事件循环执行，
+*     工作线程不等待数据库。查询完成后请求以_state为2再次交给线程池
+*返回值：是否已交给事件循环，false时由调用者同步处理
+*/
+bool HttpConn::startAsyncSql(){
+    const char* p = strchr(_url, '/');
+    if(!_loop->hasAsyncSql() || *(p+1) != '3'){
+        return false;
+    }
+    char name[USER_FIELD_LEN], password[USER_FIELD_LEN];
+    if(!getUser(name, password)){
+        /* 表单不完整，由工作线程返回注册失败 */
+        return false;
+    }
+    if(UserTable::getInstance()->contains(name, SqlPool::getInstance())){
+        /* 重名，不需要访问数据库 */
+        return false;
+    }
+    _loop->postEvent(_sockFd, _gen, CONN_EVENT_SQL);
+    return true;
+}
+
+/*
+*功能: 从登录或注册请求的内容中提取用户名和密码，内容格式为user=zhangsan&password=123345
+*参数：
+*    --name: 传出参数，用户名，至少USER_FIELD_LEN字节
+*    --password: 传出参数，密码，至少USER_FIELD_LEN字节
+*返回值：请求没有内容、格式不对或者字段过长时返回false
+*/
+bool HttpConn::getUser(char* name, char* password){
+    if(_content == NULL || strncmp(_content, "user=", 5) != 0){
+        return false;
+    }
+    const char* p = _content + 5;
+    const char* amp = strchr(p, '&');
+    if(amp == NULL || amp - p >= USER_FIELD_LEN || strncmp(amp, "&password=", 10) != 0){
+        return false;
+    }
+    const char* q = amp + 10;
+    int len = strlen(q);
+    if(len >= USER_FIELD_LEN){
+        return false;
+    }
+    memcpy(name, p, amp - p);
+    name[amp - p] = '\0';
+    memcpy(password, q, len + 1);
+    return true;
+}
+
+/*
+*功能: 插入完成后将新用户加入用户表
+*/
+void HttpConn::addUser(const char* name, const char* password){
+    UserTable::getInstance()->insert(name, password);
 }
 
 /*
@@ -322,15 +544,15 @@ HttpConn::HTTP_CODE HttpConn::processRead(){
                     return BAD_REQUEST;
                 }
                 else if(ret == GET_REQUEST){
-                    /* 响应请求 */
-                    return doRequest();
+                    /* 请求完整 */
+                    return GET_REQUEST;
                 }
                 break;
             }
             case CONTENT:{
                 ret = parseContent(text);
                 if(ret == GET_REQUEST){
-                    return doRequest();
+                    return GET_REQUEST;
                 }
                 lineState = LINE_OPEN;
                 break;
@@ -346,7 +568,7 @@ HttpConn::HTTP_CODE HttpConn::processRead(){
 *功能: 在HTTP报文中，每一行的数据由\r\n作为结束字符，空行则是仅仅是字符\r\n。
        因此，可以通过查找\r\n将报文拆解成单独的行进行解析。
        从状态机负责读取buffer中的数据，将每行数据末尾的\r\n置为\0\0，并更新在buffer中读取的位置_checkedIdx。
-       从状态机从_readBuf中逐字节读取，判断当前字节是否为\r
+       从状态机用Scanner一次比较16或32个字节，跳到_readBuf中第一个\r或\n，判断它是哪一个
        -- 是\r
           - 接下来的字符是\n，将\r\n修改成\0\0，将_checkedIdx指向下一行的开头，则返回LINE_OK
           - 接下来达到了buffer末尾，表示buffer还需要继续接收，返回LINE_OPEN
@@ -354,7 +576,7 @@ HttpConn::HTTP_CODE HttpConn::processRead(){
        -- 当前字节不是\r,是\n
           - 如果前一个字符是\r，则将\r\n修改成\0\0，将_checkedIdx指向下一行的开头，则返回LINE_OK
           - 否则，表示语法错误，返回LINE_BAD
-       -- 当前字节既不是\r，也不是\n
+       -- 没有找到\r或\n
           - 表示接收不完整，需要继续接收，返回LINE_OPEN
 *返回值：该行内容的状态
 *        - LINE_OK:   内容完整；
@@ -363,7 +585,9 @@ HttpConn::HTTP_CODE HttpConn::processRead(){
 */
 HttpConn::LINE_STATE HttpConn::parseLine(){
     char tmp;
-    for(; _checkedIdx < _readIdx; ++_checkedIdx){
+    /* 一次比较多个字节，跳过行结束符之前的内容 */
+    _checkedIdx = Scanner::findEol(_readBuf + _checkedIdx, _readBuf + _readIdx) - _readBuf;
+    if(_checkedIdx < _readIdx){
         tmp = _readBuf[_checkedIdx];
         if(tmp == '\r'){
             if((_checkedIdx + 1) == _readIdx){
@@ -486,6 +710,19 @@ HttpConn::HTTP_CODE HttpConn::parseHeaders(char* text){
         text += strspn(text, " \t");
         _host = text;
     }
+    else if(strncasecmp(text, "Cookie:", 7) == 0){
+        /* 找到会话令牌，格式为 name1=value1; sid=token; ... */
+        text += 7;
+        int len = strlen(SESSION_COOKIE);
+        while(*text){
+            text += strspn(text, " \t;");
+            if(strncmp(text, SESSION_COOKIE, len) == 0 && text[len] == '='){
+                _cookie = text + len + 1;
+                break;
+            }
+            text += strcspn(text, ";");
+        }
+    }
     else {
         LOG_INFO("oop! unknown header: %s",text);
     }
@@ -544,40 +781,38 @@ HttpConn::HTTP_CODE HttpConn::doRequest(){
         char* urlReal = (char*)malloc(sizeof(char)*FILENAME_LEN);
         strcpy(urlReal, "/");
         strcat(urlReal, _url+2);
-        strncpy(_realFile+len, urlReal, FILENAME_LEN);
+        strncpy(_realFile+len, urlReal, FILENAME_LEN-len-1);
         free(urlReal);
 
-        /* 提取用户名和密码 */
-        /* user=zhangsan&password=123345 */
-        char name[100],password[100];
-        int i;
-        for(i=5; _content[i]!='&'; i++){
-            name[i-5] = _content[i];
-        }
-        name[i-5] = '\0';
-        int j = 0;
-        for(i=i+10; _content[i]!='\0'; ++i,++j){
-            password[j] = _content[i];
+        /* 提取用户名和密码。带有效令牌的登录不需要表单，令牌和表单中的用户已由hasSession()核对 */
+        char name[USER_FIELD_LEN],password[USER_FIELD_LEN];
+        bool loggedIn = (*(p+1) == '2' && hasSession());
+
+        if(!loggedIn && _sqlResult < 0 && !getUser(name, password)){
+            /* 没有内容或者表单格式不对 */
+            strcpy(_url, *(p+1) == '3' ? "/registerError.html" : "/logError.html");
         }
-        password[j] = '\0';
-
-        if(*(p+1) == '3'){
-            /*  注册校验, 数据库中是否存在重名的 */
-            char* sqlInsert = (char*)malloc(sizeof(char)*FILENAME_LEN);
-            strcpy(sqlInsert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sqlInsert, "'");
-            strcat(sqlInsert, name);
-            strcat(sqlInsert, "', '");
-            strcat(sqlInsert, password);
-            strcat(sqlInsert, "')");
-
-            if(_users.find(name) == _users.end()){
-                _locker.lock();
-                int ret = mysql_query(_mysql, sqlInsert);
-                _users.insert(pair<string,string>(name,password));
-
-                _locker.unlock();
+        else if(*(p+1) == '3'){
+            /*  注册校验, 数据库中是否存在重名的。写入主库，重名也查主库，不受副本复制延迟的影响 */
+            SqlPool* sqlPool = SqlPool::getInstance();
+            if(_sqlResult >= 0){
+                /* 事件循环已经异步执行了插入 */
+                if(0 == _sqlResult){
+                    strcpy(_url, "/log.html");
+                }
+                else{
+                    strcpy(_url, "/registerError.html");
+                }
+            }
+            else if(UserTable::getInstance()->contains(name, sqlPool)){
+                /* 重名，不需要访问数据库 */
+                strcpy(_url, "/registerError.html");
+            }
+            else if(UserBatch::getInstance()->enabled()){
+                /* 和其他注册请求合并为一批插入 */
+                int ret = UserBatch::getInstance()->insert(name, password);
                 if(!ret){
+                    addUser(name, password);
                     strcpy(_url, "/log.html");
                 }
                 else{
@@ -585,13 +820,55 @@ HttpConn::HTTP_CODE HttpConn::doRequest(){
                 }
             }
             else{
-                strcpy(_url, "/registerError.html");
+                /* 只有注册需要数据库连接，在这里获取，离开作用域时归还 */
+                ConnRAII mysqlCon(&_mysql, sqlPool);
+                /* 使用连接上缓存的预处理语句，用户名和密码以参数传入，不拼接SQL */
+                MYSQL_STMT* stmt = sqlPool->getStatement(_mysql, SqlPool::STMT_INSERT_USER);
+                unsigned long nameLen = strlen(name);
+                unsigned long passwordLen = strlen(password);
+                MYSQL_BIND bind[2];
+                memset(bind, 0, sizeof(bind));
+                bind[0].buffer_type = MYSQL_TYPE_STRING;
+                bind[0].buffer = name;
+                bind[0].buffer_length = nameLen;
+                bind[0].length = &nameLen;
+                bind[1].buffer_type = MYSQL_TYPE_STRING;
+                bind[1].buffer = password;
+                bind[1].buffer_length = passwordLen;
+                bind[1].length = &passwordLen;
+
+                int ret = 1;
+                if(stmt && !mysql_stmt_bind_param(stmt, bind)){
+                    ret = mysql_stmt_execute(stmt);
+                }
+
+                if(ret && stmt){
+                    /* 执行失败，丢弃语句，下次重新预处理 */
+                    LOG_ERROR("INSERT error:%s", mysql_stmt_error(stmt));
+                    sqlPool->dropStatement(_mysql, SqlPool::STMT_INSERT_USER);
+                }
+                if(!ret){
+                    /* 插入成功才加入用户表 */
+                    addUser(name, password);
+                    strcpy(_url, "/log.html");
+                }
+                else{
+                    strcpy(_url, "/registerError.html");
+                }
             }
         }
+        else if(loggedIn){
+            /* 已经登录过，不再比较密码 */
+            strcpy(_url, "/welcome.html");
+        }
         else if(*(p+1) == '2'){
-            /* 登录校验 */
-            if(_users.find(name) != _users.end() && _users[name] == password){
+            /* 登录校验，只读查询交给只读副本 */
+            if(UserTable::getInstance()->check(name, password, SqlPool::getReader())){
                 strcpy(_url, "/welcome.html");
+                /* 发放令牌，之后的请求带着它不需要再校验密码 */
+                if(!SessionTable::getInstance()->create(name, _token)){
+                    _token[0] = '\0';
+                }
             }
             else{
                 strcpy(_url, "/logError.html");
@@ -602,41 +879,43 @@ HttpConn::HTTP_CODE HttpConn::doRequest(){
         /* POST请求，响应为register.html */
         char* urlReal = (char*)malloc(sizeof(char)*FILENAME_LEN);
         strcpy(urlReal, "/register.html");
-        strncpy(_realFile+len, urlReal, strlen(urlReal));
+        strcpy(_realFile+len, urlReal);
         free(urlReal);
     }
     else if(*(p+1) == '1'){
         /* POST请求,响应为log.html */
         char* urlReal = (char*)malloc(sizeof(char)*FILENAME_LEN);
         strcpy(urlReal, "/log.html");
-        strncpy(_realFile+len, urlReal, strlen(urlReal));
+        strcpy(_realFile+len, urlReal);
         free(urlReal);
     }
     else if(*(p+1) == '5'){
         /* POST请求,响应为picture.html */
         char* urlReal = (char*)malloc(sizeof(char)*FILENAME_LEN);
         strcpy(urlReal, "/picture.html");
-        strncpy(_realFile+len, urlReal, strlen(urlReal));
+        strcpy(_realFile+len, urlReal);
         free(urlReal);
     }
     else if(*(p+1) == '6'){
         /* POST请求,响应为video.html */
         char* urlReal = (char*)malloc(sizeof(char)*FILENAME_LEN);
         strcpy(urlReal, "/video.html");
-        strncpy(_realFile+len, urlReal, strlen(urlReal));
+        strcpy(_realFile+len, urlReal);
         free(urlReal);
     }
     else if(*(p+1) == '7'){
         /* POST请求,响应为fans.html */
         char* urlReal = (char*)malloc(sizeof(char)*FILENAME_LEN);
         strcpy(urlReal, "/picture.html");
-        strncpy(_realFile+len, urlReal, strlen(urlReal));
+        strcpy(_realFile+len, urlReal);
         free(urlReal);
     }
     else{
         /* 其他请求不处理 */
         strncpy(_realFile+len, _url, FILENAME_LEN-len-1);
     }
+    /* 缓冲区不再清零，strncpy截断时没有结束符 */
+    _realFile[FILENAME_LEN-1] = '\0';
     
     /* 资源是否存在 */
     if(stat(_realFile, &_fileStat) < 0){
@@ -770,7 +1049,7 @@ bool HttpConn::addStatusLine(int status, const char* title){
 *参数：contentLen: n
 */
 bool HttpConn::addHeaders(int contentLen){
-    return addContentLen(contentLen) && addLinger() && addBlankLine();
+    return addContentLen(contentLen) && addLinger() && addCookie() && addBlankLine();
 }
 
 /*
@@ -787,6 +1066,16 @@ bool HttpConn::addLinger(){
     return addResponse("Connection:%s\r\n", (_linger==true)?"keep-alive":"close");
 }
 
+/*
+*功能: 登录成功时添加首部行中的“Set-Cookie"，发放会话令牌
+*/
+bool HttpConn::addCookie(){
+    if(_token[0] == '\0'){
+        return true;
+    }
+    return addResponse("Set-Cookie:%s=%s; Path=/; Max-Age=%d; HttpOnly\r\n", SESSION_COOKIE, _token, SESSION_TTL);
+}
+
 /*
 *功能: 添加首部行中的空行
 */
@@ -803,32 +1092,11 @@ bool HttpConn::addContent(const char* content){
 }
 
 /*
-*功能: 初始化,将数据库mysql中的用户名和密码存入_users中
-*参数：sqlPool: 数据库连接池
+*功能: 初始化,开始将数据库mysql中的用户名和密码加载到用户表中，不等待加载完成
+*参数：
+*    --sqlPool: 数据库连接池
+*    --snapshot: 用户表快照文件，NULL表示不使用快照
 */
-void HttpConn::initMySQLResult(SqlPool* sqlPool){
-    /* 先从sql连接池中取出一个连接 */
-    MYSQL* mysql = NULL;
-    ConnRAII mysqlCon(&mysql, sqlPool);
-
-    /* 在user表中检索username, password 数据， 浏览器端输入 */
-    if(mysql_query(mysql, "SELECT username, passwd FROM user")){
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    /* 从表中检索完整的结果集 */
-    MYSQL_RES* result = mysql_store_result(mysql);
-
-    /* 返回结果集的列数 */
-    int num_fields = mysql_num_fields(result);
-
-    /* 返回所有字段结构的数组 */
-    MYSQL_FIELD* fields = mysql_fetch_fields(result);
-
-    /* 从结果集获取下一行，将对应的用户名和密码存入map中 */
-    while(MYSQL_ROW row = mysql_fetch_row(result)){
-        string name(row[0]);
-        string passwd(row[1]);
-        _users[name] = passwd;
-    }
+void HttpConn::initMySQLResult(SqlPool* sqlPool, const char* snapshot){
+    UserTable::getInstance()->load(sqlPool, snapshot);
 }
\ No newline at end of file
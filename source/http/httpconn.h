@@ -17,17 +17,24 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <map>
-#include <mysql/mysql.h>
+#include <atomic>
 #include <sys/uio.h>
+#include <stdint.h>
 #include "../mysql/sqlpool.h"
+#include "../mysql/userbatch.h"
+#include "../user/usertable.h"
+#include "../user/sessiontable.h"
 #include "../locker/locker.h"
+#include "bufferpool.h"
 using namespace std;
 
+class EventLoop;
+
 /* http连接类 */
 class HttpConn{
 public:
    
-   HttpConn(){}
+   HttpConn();
    ~HttpConn(){}
 
    /* 主状态： 解析哪一段请求报文 */
@@ -64,16 +71,22 @@ public:
    static const int READ_BUFFER_SIZE = 2048;
    /* 写缓冲区大小 */
    static const int WRITE_BUFFER_SIZE = 1024;
+   /* 用户名和密码的缓冲区大小，包括结尾的'\0' */
+   static const int USER_FIELD_LEN = 100;
+
+   /* 处理一个请求需要的缓冲区，请求处理期间从缓冲区池中借用，空闲的连接不占用 */
+   struct Buffer{
+      char _readBuf[READ_BUFFER_SIZE];
+      char _writeBuf[WRITE_BUFFER_SIZE];
+      char _realFile[FILENAME_LEN];
+   };
 
-   static int _epollFd;  /* epoll的文件描述符 */
-   static int _userCount; /* 已连接的客户数量 */
+   static atomic<int> _userCount; /* 已连接的客户数量，多个事件循环共同修改 */
    MYSQL* _mysql;
-   int _state;  /* 本次任务的I/O事件是读还是写，0: 读；1：写 */
-   int _timerFlag;   /* I/O事件处理结果，0：成功； 1：失败 */
-   int _improv;   /* 0: I/O事件未被处理； 1：已被处理了 */
+   int _state;  /* 本次任务的I/O事件是读还是写，0: 读；1：写；2：已解析，由数据库通道处理或异步查询已完成 */
 
-   void init(int sockFd, const sockaddr_in& addr, char* root, int trigMode,
-   int closeLog, string user, string password, string database);
+   void init(int sockFd, unsigned gen, const sockaddr_in& addr, EventLoop* loop, char* root, int trigMode,
+   int closeLog);
    void addFd(int epollFd, int sockFd, bool oneShot, int trigMode);
    int setNonblocking(int fd);
    void removeFd(int epollFd, int fd);
@@ -82,13 +95,44 @@ public:
    sockaddr_in* getAddress(){
       return &_address;
    }
+   /* 返回连接的socket */
+   int getSockFd(){
+      return _sockFd;
+   }
+   /* 返回待发送的响应报文 */
+   struct iovec* getIv(){
+      return _iv;
+   }
+   int getIvCount(){
+      return _ivCount;
+   }
    bool readOnce();
+   int readFrom(const char* data, int len);
+   void sendBusy();
    bool write();
+   bool sent(int bytes);
+   bool finishResponse();
    void process();
+   int prepare();
+   HTTP_CODE parse();
+   int respond(HTTP_CODE readRet);
+   bool needDatabase();
+   bool hasSession();
+   bool startAsyncSql();
+   bool getUser(char* name, char* password);
+   /* 事件循环的异步查询完成后设置结果，0为成功 */
+   void setSqlResult(int result){
+      _sqlResult = result;
+   }
+   static void addUser(const char* name, const char* password);
    void closeConn(bool close=true);
-   void initMySQLResult(SqlPool* sqlPool);
+   void rearm(int ev);
+   static void initMySQLResult(SqlPool* sqlPool, const char* snapshot = NULL);
 
 private:
+   /* 解析器的微基准(bench/parsebench.cpp)直接重置连接、反复解析同一个请求 */
+   friend class ParseBench;
+
    void init();
    HTTP_CODE processRead();
    bool processWrite(HTTP_CODE code);
@@ -106,19 +150,22 @@ private:
    bool addHeaders(int contentLen);
    bool addContentLen(int num);
    bool addLinger();
+   bool addCookie();
    bool addBlankLine();
    bool addContent(const char* content);
    void unmap();
+   void acquireBuffer();
+   void releaseBuffer();
    
 private:
    int _sockFd;    /* 连接后的socket */
+   unsigned _gen;  /* 连接的代数，和fd一起放入epoll_event.data.u64，区分重用同一fd的连接 */
+   int _epollFd;   /* 连接所属事件循环的epoll，io_uring后端为-1 */
+   EventLoop* _loop;  /* 连接所属的事件循环 */
    sockaddr_in _address;  /* 客户端地址 */
    int _trigMode;   /* epoll触发模式 */
    char* _root;     /* 资源存放的路径 */
    int _closeLog;   /* 日志文件关闭方式 */
-   char _sqlUser[100];  /* sql用户名 */
-   char _sqlPassword[100];  /* sql密码 */
-   char _sqlDatabase[100];  /* sql库名 */
 
    int _bytesToSend;         /* 未发送的字节数 */
    int _bytesHaveSend;       /* 已发送的字节数 */
@@ -130,19 +177,24 @@ private:
    char* _host; /* host */
    int _contentLen;  /* 内容长度 */
    int _cgi;   /* 是否启用POST */
+   int _sqlResult;  /* 异步查询的结果，0为成功；-1表示没有异步查询，由doRequest同步访问数据库 */
    char* _content; /* 存储请求的content */
+   char* _cookie;  /* Cookie中会话令牌的起始位置，NULL表示没有 */
+   int _session;   /* 令牌是否有效，-1: 尚未检查；0: 无效；1: 有效 */
+   char _token[SESSION_TOKEN_LEN + 1];  /* 登录成功后新发放的令牌，空串表示不发放 */
 
+   Buffer* _buf;      /* 借用的缓冲区，连接空闲时为NULL */
    /* 存放要发出的响应报文 */
-   char _writeBuf[WRITE_BUFFER_SIZE];
+   char* _writeBuf;
    int _writeIdx;     /* 写缓冲区中字节个数 */
    /* 存放读取的请求数据 */
-   char _readBuf[READ_BUFFER_SIZE];
+   char* _readBuf;
    int _readIdx;        /* 读缓冲区中最后一个字节的下一个位置,也就是可以开始存放数据的位置 */
    int _checkedIdx;     /* 从状态机在读缓冲区中已经读取位置的下一个位置 */
    int _startLine;      /* 读缓冲区中下一行内容的首地址 */
    
    struct stat _fileStat;  /* 请求资源的状态 */
-   char _realFile[FILENAME_LEN];  /* 存放响应文件的路径名 */
+   char* _realFile;  /* 存放响应文件的路径名 */
    char* _fileAddress;  /* 响应文件对应内存映射的首地址 */
    struct iovec _iv[2];  /*  用来整合存放响应报文 */
    int _ivCount; 
@@ -0,0 +1,126 @@
+#include "scanner.h"
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+const char* Scanner::_name = "scalar";
+Scanner::FindEol Scanner::_findEol = Scanner::choose();
+
+/*
+*功能：程序启动时按CPU支持的指令集选择实现
+*/
+Scanner::FindEol Scanner::choose(){
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        _name = "avx2";
+        return findEolAvx2;
+    }
+    /* SSE2是x86-64的基本指令集 */
+    _name = "sse2";
+    return findEolSse2;
+#else
+    _name = "scalar";
+    return findEolScalar;
+#endif
+}
+
+/*
+*功能：按名字切换实现，供微基准比较各个实现
+*参数：
+*      --name: scalar、sse2或avx2
+*返回值：名字不对或CPU不支持时返回false，不切换
+*/
+bool Scanner::use(const char* name){
+    if(strcmp(name, "scalar") == 0){
+        _findEol = findEolScalar;
+    }
+#if defined(__x86_64__)
+    else if(strcmp(name, "sse2") == 0){
+        _findEol = findEolSse2;
+    }
+    else if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")){
+        _findEol = findEolAvx2;
+    }
+#endif
+    else{
+        return false;
+    }
+    _name = name;
+    return true;
+}
+
+/*
+*功能：逐字节查找，用于向量化实现剩余的不足一次比较的字节
+*/
+const char* Scanner::findEolScalar(const char* begin, const char* end){
+    for(; begin < end; ++begin){
+        if(*begin == '\r' || *begin == '\n'){
+            return begin;
+        }
+    }
+    return end;
+}
+
+#if defined(__x86_64__)
+
+/*
+*功能：每次比较16个字节，两次比较的结果合并后取出掩码，最低的置位即第一个行结束符
+*/
+const char* Scanner::findEolSse2(const char* begin, const char* end){
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for(; begin + 16 <= end; begin += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)begin);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if(mask){
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return findEolScalar(begin, end);
+}
+
+/*
+*功能：每次比较32个字节，只对本函数生成AVX2指令，其他代码不受影响。
+*     剩余的字节也在本函数中比较，不调用SSE2的实现，避免AVX和SSE指令切换的开销
+*/
+__attribute__((target("avx2")))
+const char* Scanner::findEolAvx2(const char* begin, const char* end){
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for(; begin + 32 <= end; begin += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)begin);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        if(mask){
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    if(begin + 16 <= end){
+        __m128i v = _mm_loadu_si128((const __m128i*)begin);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(cr)),
+                                                  _mm_cmpeq_epi8(v, _mm256_castsi256_si128(lf))));
+        if(mask){
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 16;
+    }
+    for(; begin < end; ++begin){
+        if(*begin == '\r' || *begin == '\n'){
+            return begin;
+        }
+    }
+    return end;
+}
+
+#else
+
+const char* Scanner::findEolSse2(const char* begin, const char* end){
+    return findEolScalar(begin, end);
+}
+
+const char* Scanner::findEolAvx2(const char* begin, const char* end){
+    return findEolScalar(begin, end);
+}
+
+#endif
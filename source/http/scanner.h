@@ -0,0 +1,40 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-27
+@Detail    : 请求报文的向量化扫描，每次比较16或32个字节，找到行结束符的位置。
+             启动时按CPU支持的指令集选择实现
+@Reference : https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+*/
+
+#ifndef SCANNER_H
+#define SCANNER_H
+
+/* 扫描器类：findEol()在[begin, end)中查找第一个'\r'或'\n'，只读取范围内的字节。
+   x86-64上有AVX2时每次比较32个字节，否则用SSE2每次比较16个字节，其他平台逐字节比较。
+   glibc的strpbrk/strspn等已经按CPU选择了向量化的实现，这里只替换parseLine()中逐字节的循环 */
+class Scanner{
+public:
+    typedef const char* (*FindEol)(const char* begin, const char* end);
+
+    /* 查找行结束符，没有则返回end */
+    static const char* findEol(const char* begin, const char* end){
+        return _findEol(begin, end);
+    }
+    /* 当前使用的实现的名字 */
+    static const char* name(){
+        return _name;
+    }
+    /* 切换到指定的实现，用于bench/parsebench.cpp比较各个实现 */
+    static bool use(const char* name);
+
+private:
+    static FindEol choose();
+    static const char* findEolScalar(const char* begin, const char* end);
+    static const char* findEolSse2(const char* begin, const char* end);
+    static const char* findEolAvx2(const char* begin, const char* end);
+
+    static const char* _name;   /* 启动时选择的实现，可以用use()切换 */
+    static FindEol _findEol;
+};
+
+#endif
@@ -12,6 +12,14 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/time.h>
+#include <time.h>
+#include <errno.h>
+#include <atomic>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 /* 信号量类 */
 class Sem{
@@ -31,6 +39,7 @@ public:
     ~Sem(){ sem_destroy(&_sem); }
 
     bool wait(){ return sem_wait(&_sem) == 0; }
+    bool trywait(){ return sem_trywait(&_sem) == 0; }
     bool post(){ return sem_post(&_sem) == 0; }
 
 private:
@@ -86,4 +95,66 @@ private:
     pthread_cond_t _cond;
 };
 
+/* 事件计数类：配合无锁队列使用，消费者只有在队列确实为空时才在futex上休眠，
+   生产者只有在有消费者休眠时才进行系统调用。
+   消费者: key = prepareWait(); 再检查一次条件; 条件满足则cancelWait(), 否则wait(key) */
+class EventCount{
+public:
+    EventCount(){
+        _seq.store(0, std::memory_order_relaxed);
+        _waiters.store(0, std::memory_order_relaxed);
+    }
+
+    /* 登记为等待者，返回当前序号 */
+    uint32_t prepareWait(){
+        uint32_t key = _seq.load(std::memory_order_acquire);
+        _waiters.fetch_add(1, std::memory_order_seq_cst);
+        return key;
+    }
+
+    void cancelWait(){
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /* 序号没有变化则休眠，期间有notify则立即返回。timeout为NULL时不超时，超时返回false */
+    bool wait(uint32_t key, const struct timespec* timeout = NULL){
+        bool ret = true;
+        if(_seq.load(std::memory_order_acquire) == key){
+            if(syscall(SYS_futex, &_seq, FUTEX_WAIT_PRIVATE, key, timeout, NULL, 0) == -1 && errno == ETIMEDOUT){
+                ret = false;
+            }
+        }
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
+        return ret;
+    }
+
+    /* 登记了的等待者数量，即空闲的线程数 */
+    int waiters(){
+        return _waiters.load(std::memory_order_relaxed);
+    }
+
+    /* 条件已经改变(如元素已入队)后调用，唤醒一个等待者 */
+    void notify(){
+        /* 和prepareWait中的fetch_add配对，保证要么生产者看到等待者，要么等待者看到新元素 */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(_waiters.load(std::memory_order_relaxed) > 0){
+            _seq.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, &_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+
+    /* 唤醒所有等待者，如线程池析构时让工作线程退出 */
+    void notifyAll(){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(_waiters.load(std::memory_order_relaxed) > 0){
+            _seq.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, &_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+        }
+    }
+
+private:
+    std::atomic<uint32_t> _seq;     /* 每次唤醒加1，futex等待的字 */
+    std::atomic<int> _waiters;      /* 登记了的等待者数量 */
+};
+
 #endif
@@ -0,0 +1,142 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-5
+@Detail    : 无锁有界队列，多生产者多消费者(Dmitry Vyukov的环形队列算法)
+@Reference : https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <exception>
+#include <stddef.h>
+#include <stdint.h>
+using namespace std;
+
+/* 缓存行大小，用于隔开生产者和消费者修改的变量，避免伪共享 */
+const int CACHE_LINE_SIZE = 64;
+
+/* 无锁有界队列：每个槽位带一个序号，生产者和消费者各自通过CAS抢占位置，
+   再根据槽位序号判断该位置能否写入或读取，不需要加锁，入队出队也不分配内存 */
+template<class T>
+class LockFreeQueue{
+public:
+    /* 队列容量必须是2的幂 */
+    LockFreeQueue(int maxSize = 1024){
+        if(maxSize < 2 || (maxSize & (maxSize - 1)) != 0){
+            throw std::exception();
+        }
+        _mask = maxSize - 1;
+        _buffer = new Cell[maxSize];
+        for(int i=0; i<maxSize; ++i){
+            _buffer[i]._seq.store(i, memory_order_relaxed);
+        }
+        _enqueuePos.store(0, memory_order_relaxed);
+        _dequeuePos.store(0, memory_order_relaxed);
+    }
+
+    ~LockFreeQueue(){
+        delete[] _buffer;
+    }
+
+    bool push(const T& item);
+    bool pop(T& item);
+    int size();
+
+private:
+    struct Cell{
+        atomic<size_t> _seq;  /* 槽位序号，等于入队位置时可写，等于入队位置+1时可读 */
+        T _data;
+    };
+
+    char _pad0[CACHE_LINE_SIZE];
+    Cell* _buffer;                /* 环形数组 */
+    size_t _mask;                 /* 容量-1，用于取模 */
+    char _pad1[CACHE_LINE_SIZE];
+    atomic<size_t> _enqueuePos;   /* 下一个入队位置，生产者修改 */
+    char _pad2[CACHE_LINE_SIZE];
+    atomic<size_t> _dequeuePos;   /* 下一个出队位置，消费者修改 */
+    char _pad3[CACHE_LINE_SIZE];
+};
+
+/*
+*功能：入队
+*参数：item: 入队的元素
+*返回值：队列已满时返回false
+*/
+template<class T>
+bool LockFreeQueue<T>::push(const T& item){
+    Cell* cell;
+    size_t pos = _enqueuePos.load(memory_order_relaxed);
+    while(true){
+        cell = &_buffer[pos & _mask];
+        size_t seq = cell->_seq.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0){
+            /* 槽位空闲，抢占该位置 */
+            if(_enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+                break;
+            }
+        }
+        else if(diff < 0){
+            /* 槽位中的元素还未被取走，队列已满 */
+            return false;
+        }
+        else{
+            /* 被其他生产者抢先了，重新读取位置 */
+            pos = _enqueuePos.load(memory_order_relaxed);
+        }
+    }
+    cell->_data = item;
+    /* 发布元素，消费者可见 */
+    cell->_seq.store(pos + 1, memory_order_release);
+    return true;
+}
+
+/*
+*功能：出队
+*参数：item: 传出参数，出队的元素
+*返回值：队列为空时返回false
+*/
+template<class T>
+bool LockFreeQueue<T>::pop(T& item){
+    Cell* cell;
+    size_t pos = _dequeuePos.load(memory_order_relaxed);
+    while(true){
+        cell = &_buffer[pos & _mask];
+        size_t seq = cell->_seq.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(diff == 0){
+            /* 槽位中有元素，抢占该位置 */
+            if(_dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+                break;
+            }
+        }
+        else if(diff < 0){
+            /* 槽位中还没有元素，队列为空 */
+            return false;
+        }
+        else{
+            /* 被其他消费者抢先了，重新读取位置 */
+            pos = _dequeuePos.load(memory_order_relaxed);
+        }
+    }
+    item = cell->_data;
+    /* 释放槽位，留给下一圈的生产者 */
+    cell->_seq.store(pos + _mask + 1, memory_order_release);
+    return true;
+}
+
+/*
+*功能：获得队列里元素个数，并发修改时只是近似值
+*返回值： int 队列元素个数
+*/
+template<class T>
+int LockFreeQueue<T>::size(){
+    size_t enqueuePos = _enqueuePos.load(memory_order_relaxed);
+    size_t dequeuePos = _dequeuePos.load(memory_order_relaxed);
+    return enqueuePos > dequeuePos ? (int)(enqueuePos - dequeuePos) : 0;
+}
+
+#endif
@@ -0,0 +1,370 @@
+#include "asyncsql.h"
+#include <sys/epoll.h>
+
+AsyncSql::AsyncSql(){
+    _sqlPool = NULL;
+    _slots = NULL;
+    _slotNum = 0;
+    _maxWait = 0;
+    _closeLog = 0;
+}
+
+AsyncSql::~AsyncSql(){
+    for(int i=0; i<_slotNum; ++i){
+        if(_slots[i]._state.load(memory_order_acquire) != SLOT_OK){
+            /* 等待维护线程放手 */
+            _sqlPool->cancelJob(_slots + i);
+        }
+        if(_slots[i]._stmt){
+            mysql_stmt_close(_slots[i]._stmt);
+        }
+        if(_slots[i]._mysql){
+            mysql_close(_slots[i]._mysql);
+        }
+    }
+    delete[] _slots;
+}
+
+#if defined(USE_MARIADB) && !defined(MYSQL_WAIT_READ)
+#error "MARIADB=1 but the client library has no non-blocking API"
+#endif
+
+#ifdef MYSQL_WAIT_READ
+/* MariaDB客户端库，提供非阻塞接口 */
+
+/*
+*功能：是否支持异步查询，取决于编译时的客户端库
+*/
+bool AsyncSql::supported(){
+    return true;
+}
+
+/*
+*功能：创建非阻塞连接，预处理插入语句。初始化阶段使用阻塞方式连接
+*参数：
+*      --sqlPool: 提供数据库地址、用户名等参数
+*      --connNum: 连接数量
+*      --maxWait: 排队查询数量的最大值
+*返回值：有连接不可用时返回false
+*/
+bool AsyncSql::init(SqlPool* sqlPool, int connNum, int maxWait){
+    _sqlPool = sqlPool;
+    _closeLog = sqlPool->_closeLog;
+    _maxWait = maxWait;
+    /* 连接由构造函数置空，中途失败时析构只关闭已经建立的 */
+    _slots = new Slot[connNum];
+    _slotNum = connNum;
+    for(int i=0; i<connNum; ++i){
+        Slot* slot = _slots + i;
+        slot->_owner = this;
+        if(!connect(slot) || !prepare(slot)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+*功能：建立非阻塞连接，阻塞方式，只在初始化和维护线程中调用
+*/
+bool AsyncSql::connect(Slot* slot){
+    slot->_mysql = mysql_init(NULL);
+    if(slot->_mysql == NULL){
+        LOG_ERROR("%s", "async MYSQL init failed");
+        return false;
+    }
+    mysql_options(slot->_mysql, MYSQL_OPT_NONBLOCK, 0);
+    if(mysql_real_connect(slot->_mysql, _sqlPool->_url.c_str(), _sqlPool->_user.c_str(),
+           _sqlPool->_password.c_str(), _sqlPool->_database.c_str(), _sqlPool->_port, NULL, 0) == NULL){
+        LOG_ERROR("async MYSQL connect failed:%s", mysql_error(slot->_mysql));
+        mysql_close(slot->_mysql);
+        slot->_mysql = NULL;
+        return false;
+    }
+    slot->_fd = mysql_get_socket(slot->_mysql);
+    return true;
+}
+
+/*
+*功能：在连接上预处理插入语句，阻塞方式，只在初始化和维护线程中调用
+*/
+bool AsyncSql::prepare(Slot* slot){
+    if(slot->_stmt){
+        mysql_stmt_close(slot->_stmt);
+        slot->_stmt = NULL;
+    }
+    MYSQL_STMT* stmt = mysql_stmt_init(slot->_mysql);
+    if(stmt == NULL){
+        LOG_ERROR("mysql_stmt_init failed:%s", mysql_error(slot->_mysql));
+        return false;
+    }
+    if(mysql_stmt_prepare(stmt, SqlPool::STMT_SQL[SqlPool::STMT_INSERT_USER],
+                          strlen(SqlPool::STMT_SQL[SqlPool::STMT_INSERT_USER]))){
+        LOG_ERROR("mysql_stmt_prepare failed:%s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return false;
+    }
+    slot->_stmt = stmt;
+    return true;
+}
+
+/*
+*功能：维护线程调用，连接断开则重连，再重新预处理语句。修好后交回事件循环
+*返回值：失败返回false，由维护线程稍后重试
+*/
+bool AsyncSql::repair(Slot* slot){
+    if(slot->_stmt){
+        mysql_stmt_close(slot->_stmt);
+        slot->_stmt = NULL;
+    }
+    if(slot->_mysql && mysql_ping(slot->_mysql) != 0){
+        mysql_close(slot->_mysql);
+        slot->_mysql = NULL;
+    }
+    if(slot->_mysql == NULL && !connect(slot)){
+        return false;
+    }
+    if(!prepare(slot)){
+        /* 可能是连接的问题，下次重试时重新检查 */
+        return false;
+    }
+    LOG_INFO("%s", "async MYSQL connection repaired");
+    slot->_state.store(SLOT_REPAIRED, memory_order_release);
+    return true;
+}
+
+bool AsyncSql::repairJob(void* arg){
+    Slot* slot = (Slot*)arg;
+    return slot->_owner->repair(slot);
+}
+
+/*
+*功能：连接出错，交给连接池的维护线程重连和重新预处理，修好之前不再分配查询
+*/
+void AsyncSql::markBroken(Slot* slot){
+    slot->_watch = false;
+    slot->_state.store(SLOT_BROKEN, memory_order_relaxed);
+    if(_sqlPool->runLater(repairJob, slot)){
+        LOG_WARN("%s", "async MYSQL connection broken, reconnect in background");
+    }
+    else{
+        LOG_ERROR("%s", "async MYSQL connection broken, no maintainer to reconnect");
+    }
+}
+
+/*
+*功能：连接是否可以分配查询，维护线程修好的连接在这里取回
+*/
+bool AsyncSql::usable(Slot* slot){
+    int state = slot->_state.load(memory_order_acquire);
+    if(SLOT_REPAIRED == state){
+        slot->_state.store(SLOT_OK, memory_order_relaxed);
+        return true;
+    }
+    return SLOT_OK == state;
+}
+
+/*
+*功能：在空闲的连接上开始执行查询
+*参数：
+*      --ret: 传出参数，立即完成时查询的结果
+*返回值：非阻塞接口的返回值，0表示已经完成
+*/
+int AsyncSql::begin(Slot* slot, int& ret){
+    slot->_busy = true;
+    SqlQuery& query = slot->_query;
+    slot->_lens[0] = strlen(query._name);
+    slot->_lens[1] = strlen(query._password);
+    MYSQL_BIND bind[2];
+    memset(bind, 0, sizeof(bind));
+    bind[0].buffer_type = MYSQL_TYPE_STRING;
+    bind[0].buffer = query._name;
+    bind[0].buffer_length = slot->_lens[0];
+    bind[0].length = &slot->_lens[0];
+    bind[1].buffer_type = MYSQL_TYPE_STRING;
+    bind[1].buffer = query._password;
+    bind[1].buffer_length = slot->_lens[1];
+    bind[1].length = &slot->_lens[1];
+    if(mysql_stmt_bind_param(slot->_stmt, bind)){
+        ret = 1;
+        return 0;
+    }
+    ret = 0;
+    return mysql_stmt_execute_start(&ret, slot->_stmt);
+}
+
+/*
+*功能：在空闲的连接上开始执行查询
+*/
+void AsyncSql::start(Slot* slot){
+    int ret = 0;
+    int status = begin(slot, ret);
+    finish(slot, status, ret);
+}
+
+/*
+*功能：处理非阻塞调用的返回。需要等待则记录要监听的事件；完成则记录结果，开始下一个排队的查询
+*参数：
+*      --status: 非阻塞接口的返回值，0表示完成，否则为MYSQL_WAIT_*的组合
+*      --ret: 完成时查询的结果，0为成功
+*/
+void AsyncSql::finish(Slot* slot, int status, int ret){
+    while(true){
+        if(status != 0){
+            slot->_events = 0;
+            if(status & MYSQL_WAIT_READ){
+                slot->_events |= EPOLLIN;
+            }
+            if(status & MYSQL_WAIT_WRITE){
+                slot->_events |= EPOLLOUT;
+            }
+            if(status & MYSQL_WAIT_EXCEPT){
+                slot->_events |= EPOLLPRI;
+            }
+            slot->_watch = true;
+            return;
+        }
+
+        /* 查询完成 */
+        if(ret){
+            LOG_ERROR("async INSERT error:%s", mysql_stmt_error(slot->_stmt));
+            /* 客户端错误说明连接已经不可用；重名等服务器错误不影响语句 */
+            if(mysql_stmt_errno(slot->_stmt) >= CR_MIN_ERROR){
+                markBroken(slot);
+            }
+        }
+        _done.push_back(make_pair(slot->_query, ret));
+        slot->_busy = false;
+        if(_waiting.empty() || slot->_state.load(memory_order_relaxed) != SLOT_OK){
+            return;
+        }
+        /* 连接空闲，执行下一个排队的查询 */
+        slot->_query = _waiting.front();
+        _waiting.pop_front();
+        status = begin(slot, ret);
+    }
+}
+
+/*
+*功能：提交查询，有空闲连接则立即开始，否则排队
+*返回值：排队的查询过多时返回false
+*/
+bool AsyncSql::submit(const SqlQuery& query){
+    for(int i=0; i<_slotNum; ++i){
+        if(!_slots[i]._busy && usable(_slots + i)){
+            _slots[i]._query = query;
+            start(_slots + i);
+            return true;
+        }
+    }
+    if((int)_waiting.size() >= _maxWait){
+        return false;
+    }
+    _waiting.push_back(query);
+    return true;
+}
+
+/*
+*功能：连接的socket就绪，继续执行查询
+*参数：
+*      --fd: 就绪的socket
+*      --events: 就绪的事件，EPOLLIN/EPOLLOUT
+*返回值：fd不属于本客户端时返回false
+*/
+bool AsyncSql::resume(int fd, int events){
+    for(int i=0; i<_slotNum; ++i){
+        Slot* slot = _slots + i;
+        if(!slot->_busy || slot->_fd != fd){
+            continue;
+        }
+        int ready = 0;
+        if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+            ready |= MYSQL_WAIT_READ;
+        }
+        if(events & EPOLLOUT){
+            ready |= MYSQL_WAIT_WRITE;
+        }
+        if(events & EPOLLPRI){
+            ready |= MYSQL_WAIT_EXCEPT;
+        }
+        int ret = 0;
+        int status = mysql_stmt_execute_cont(&ret, slot->_stmt, ready);
+        finish(slot, status, ret);
+        return true;
+    }
+    return false;
+}
+
+/*
+*功能：事件循环的定时器到期时调用，取回维护线程修好的连接，执行排队的查询
+*/
+void AsyncSql::tick(){
+    for(int i=0; i<_slotNum && !_waiting.empty(); ++i){
+        Slot* slot = _slots + i;
+        if(!slot->_busy && usable(slot)){
+            slot->_query = _waiting.front();
+            _waiting.pop_front();
+            start(slot);
+        }
+    }
+}
+
+#else
+/* MySQL客户端库没有非阻塞接口，不支持异步查询，WebServer启动时拒绝-g参数 */
+
+bool AsyncSql::supported(){
+    return false;
+}
+
+bool AsyncSql::init(SqlPool* sqlPool, int connNum, int maxWait){
+    _closeLog = sqlPool->_closeLog;
+    LOG_ERROR("%s", "async sql needs the MariaDB client library");
+    return false;
+}
+
+bool AsyncSql::submit(const SqlQuery& query){
+    return false;
+}
+
+bool AsyncSql::resume(int fd, int events){
+    return false;
+}
+
+void AsyncSql::tick(){
+}
+
+#endif
+
+/*
+*功能：取出一个需要事件循环监听的socket，每次socket需要等待时取出一次
+*参数：
+*      --fd: 传出参数，socket
+*      --events: 传出参数，需要监听的事件
+*/
+bool AsyncSql::nextWatch(int& fd, int& events){
+    for(int i=0; i<_slotNum; ++i){
+        if(_slots[i]._watch){
+            _slots[i]._watch = false;
+            fd = _slots[i]._fd;
+            events = _slots[i]._events;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+*功能：取出一个完成的查询
+*参数：
+*      --query: 传出参数，查询
+*      --result: 传出参数，结果，0为成功
+*/
+bool AsyncSql::popDone(SqlQuery& query, int& result){
+    if(_done.empty()){
+        return false;
+    }
+    query = _done.front().first;
+    result = _done.front().second;
+    _done.pop_front();
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-18
+@Detail    : 异步数据库客户端，使用MariaDB的非阻塞接口，连接的socket由事件循环监听，查询期间不占用线程
+@Reference : https://mariadb.com/kb/en/using-the-non-blocking-library/
+*/
+
+#ifndef ASYNCSQL_H
+#define ASYNCSQL_H
+
+#include <list>
+#include <atomic>
+#include <string.h>
+#include "sqlpool.h"
+using namespace std;
+
+/* 一次异步查询：注册一个用户 */
+struct SqlQuery{
+    int _sockFd;            /* 发起查询的http连接 */
+    unsigned _gen;          /* http连接的代数，查询期间连接可能已经关闭 */
+    char _name[100];        /* 用户名 */
+    char _password[100];    /* 密码 */
+};
+
+/* 异步数据库客户端类：每个事件循环一个，只在事件循环线程中使用，不加锁。
+   拥有若干非阻塞连接，每个连接同时执行一个查询，其余查询排队。
+   查询需要等待socket时，由事件循环监听该socket，就绪后调用resume()继续。
+   连接出错后交给连接池的维护线程重连和重新预处理，事件循环不阻塞，
+   在tick()或submit()中取回修好的连接 */
+class AsyncSql{
+public:
+    AsyncSql();
+    ~AsyncSql();
+
+    static bool supported();
+    bool init(SqlPool* sqlPool, int connNum, int maxWait);
+    bool submit(const SqlQuery& query);
+    bool resume(int fd, int events);
+    bool nextWatch(int& fd, int& events);
+    bool popDone(SqlQuery& query, int& result);
+    void tick();
+
+private:
+    /* 连接的状态 */
+    enum SLOT_STATE{
+        SLOT_OK = 0,      /* 可用，由事件循环使用 */
+        SLOT_BROKEN,      /* 出错，已交给维护线程 */
+        SLOT_REPAIRED     /* 维护线程已修好，等待事件循环取回 */
+    };
+    /* 一个非阻塞连接 */
+    struct Slot{
+        Slot():_mysql(NULL), _stmt(NULL), _fd(-1), _busy(false), _watch(false), _events(0),
+            _state(SLOT_OK), _owner(NULL){}
+
+        MYSQL* _mysql;
+        MYSQL_STMT* _stmt;      /* 预处理的插入语句 */
+        int _fd;                /* 连接的socket */
+        bool _busy;             /* 是否正在执行查询 */
+        bool _watch;            /* 是否需要事件循环(重新)监听socket */
+        int _events;            /* 需要监听的事件，EPOLLIN/EPOLLOUT */
+        SqlQuery _query;        /* 正在执行的查询 */
+        unsigned long _lens[2]; /* 参数长度 */
+        atomic<int> _state;     /* SLOT_STATE, 不是SLOT_OK时连接、语句和socket属于维护线程 */
+        AsyncSql* _owner;       /* 所属的客户端 */
+    };
+
+    bool connect(Slot* slot);
+    bool prepare(Slot* slot);
+    int begin(Slot* slot, int& ret);
+    void start(Slot* slot);
+    void finish(Slot* slot, int status, int ret);
+    void markBroken(Slot* slot);
+    bool usable(Slot* slot);
+    bool repair(Slot* slot);
+    static bool repairJob(void* arg);
+
+    SqlPool* _sqlPool;         /* 提供连接参数 */
+    Slot* _slots;              /* 连接数组 */
+    int _slotNum;              /* 连接数量 */
+    int _maxWait;              /* 排队查询数量的最大值 */
+    list<SqlQuery> _waiting;   /* 排队的查询 */
+    list<pair<SqlQuery, int> > _done;  /* 完成的查询和结果，0为成功 */
+    int _closeLog;             /* 日志开关 */
+};
+
+#endif
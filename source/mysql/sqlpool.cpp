@@ -1,9 +1,25 @@
 #include "sqlpool.h"
+#include <time.h>
 
+thread_local MYSQL* SqlPool::_localConn = NULL;
+thread_local bool SqlPool::_localBusy = false;
+thread_local MYSQL_STMT* SqlPool::_localStmts[SqlPool::STMT_NUM];
+
+/* 预处理语句，按STMT_ID排列 */
+const char* const SqlPool::STMT_SQL[SqlPool::STMT_NUM] = {
+    "INSERT INTO user(username, passwd) VALUES(?, ?)"
+};
 
 SqlPool::SqlPool(){
+    _maxConn = 0;
     _curConn = 0;
     _freeConn = 0;
+    _pinMode = 0;
+    _slots = NULL;
+    _gens = NULL;
+    _stop = false;
+    _nextHost = 0;
+    _runningJob = NULL;
 }
 
 SqlPool::~SqlPool(){
@@ -11,47 +27,432 @@ SqlPool::~SqlPool(){
 }
 
 /*
-*功能：单例模式，获得连接池的一个对象,全局仅此一个对象
+*功能：单例模式，获得连接池的一个对象，主库和只读副本各一个对象
+*参数：
+*      --role: PRIMARY或REPLICA
 */
-SqlPool* SqlPool::getInstance(){
+SqlPool* SqlPool::getInstance(int role){
     static SqlPool sqlPool;
-    return &sqlPool;
+    static SqlPool replicaPool;
+    return REPLICA == role ? &replicaPool : &sqlPool;
+}
+
+/*
+*功能：获得执行只读查询的连接池，没有配置只读副本时为主库
+*/
+SqlPool* SqlPool::getReader(){
+    SqlPool* replica = getInstance(REPLICA);
+    return replica->_maxConn > 0 ? replica : getInstance(PRIMARY);
 }
 
 /*
-*功能：创建连接池，存放在链表中
+*功能：创建连接池，存放在链表中。并行建立minConn个连接，少于minConn个则退出；
+*     其余的连接交给维护线程在后台建立，不等待
+*参数：
+*      --url: 主机地址。只读副本可以有多个，以逗号分隔，每个可以带端口，如"10.0.0.2:3306,10.0.0.3"
+*      --port: 没有指定端口的主机使用的端口号
+*      --maxConn: 连接数量
+*      --pinMode: 是否为每个工作线程创建独占的连接
+*      --minConn: 开始服务前必须建立的连接数量
 */
 void SqlPool::init(string url, string user, string password, string database,
-                   int port, int maxConn, int closeLog){
-    _url = url;
-    _port = port;
+                   int port, int maxConn, int closeLog, int pinMode, int minConn){
+    /* 解析主机列表 */
+    size_t begin = 0;
+    while(begin <= url.size()){
+        size_t end = url.find(',', begin);
+        if(end == string::npos){
+            end = url.size();
+        }
+        string host = url.substr(begin, end - begin);
+        if(!host.empty()){
+            size_t colon = host.find(':');
+            _urls.push_back(host.substr(0, colon));
+            _ports.push_back(colon == string::npos ? port : atoi(host.c_str() + colon + 1));
+        }
+        begin = end + 1;
+    }
+    if(_urls.empty()){
+        _urls.push_back(url);
+        _ports.push_back(port);
+    }
+    _url = _urls[0];
+    _port = _ports[0];
     _user = user;
     _password = password;
     _database = database;
     _closeLog = closeLog;
+    _pinMode = pinMode;
+    if(maxConn <= 0){
+        return;
+    }
+    /* 客户端库的全局初始化不是线程安全的，在创建任何使用连接的线程之前完成，主库和副本的连接池共用一次 */
+    static bool libraryReady = (mysql_library_init(0, NULL, NULL) == 0);
+    if(!libraryReady){
+        LOG_ERROR("%s", "MYSQL library init failed");
+        exit(1);
+    }
+    if(minConn > maxConn){
+        minConn = maxConn;
+    }
 
+    /* 连接对象和语句缓存一次分配好，之后只在原地连接和重连 */
+    _slots = new MYSQL[maxConn];
+    _gens = new unsigned[maxConn];
+    _maxConn = maxConn;
     for(int i=0; i<maxConn; ++i){
-        /* 初始化一个mysql对象 */
-        MYSQL* conn = NULL;
-        conn = mysql_init(conn);
-        if(conn == NULL){
-            LOG_ERROR("MYSQL init failed");
-            exit(1);
+        MYSQL_STMT** stmts = new MYSQL_STMT*[STMT_NUM];
+        for(int j=0; j<STMT_NUM; ++j){
+            stmts[j] = NULL;
+        }
+        _stmts[_slots + i] = stmts;
+        _gens[i] = 0;
+    }
+
+    /* 每个连接一个线程同时握手，耗时约为一次握手而不是minConn次 */
+    pthread_t* threads = new pthread_t[minConn];
+    pair<SqlPool*, MYSQL*>* tasks = new pair<SqlPool*, MYSQL*>[minConn];
+    for(int i=0; i<minConn; ++i){
+        tasks[i] = make_pair(this, _slots + i);
+        if(pthread_create(threads + i, NULL, connector, tasks + i) != 0){
+            throw std::exception();
+        }
+    }
+    int opened = 0;
+    for(int i=0; i<minConn; ++i){
+        void* conn = NULL;
+        pthread_join(threads[i], &conn);
+        if(conn){
+            addConnection(_slots + i);
+            ++opened;
+        }
+        else{
+            _broken.push_back(_slots + i);
+        }
+    }
+    delete[] threads;
+    delete[] tasks;
+    if(opened < minConn){
+        LOG_ERROR("only %d of %d MYSQL connections opened", opened, minConn);
+        exit(1);
+    }
+    for(int i=minConn; i<maxConn; ++i){
+        _broken.push_back(_slots + i);
+    }
+
+    if(pthread_create(&_maintainer, NULL, maintainer, this) != 0){
+        throw std::exception();
+    }
+}
+
+/*
+*功能：建立连接的线程
+*参数：
+*      --arg: 连接池和连接对象
+*返回值：成功返回连接对象，失败返回NULL
+*/
+void* SqlPool::connector(void* arg){
+    pair<SqlPool*, MYSQL*>* task = (pair<SqlPool*, MYSQL*>*)arg;
+    /* 线程退出前释放客户端库为本线程分配的资源 */
+    mysql_thread_init();
+    MYSQL* conn = task->first->connect(task->second);
+    mysql_thread_end();
+    return conn;
+}
+
+/*
+*功能：连接所连的数据库在主机列表中的下标。预先分配的连接按位置固定分配，连接断开后重连到同一个数据库
+*/
+int SqlPool::hostOf(MYSQL* conn){
+    int num = _urls.size();
+    if(conn >= _slots && conn < _slots + _maxConn){
+        return (conn - _slots) % num;
+    }
+    return _nextHost.fetch_add(1, memory_order_relaxed) % num;
+}
+
+/*
+*功能：创建一个到数据库的连接
+*参数：
+*      --conn: 预先分配的连接对象，在其上建立连接；NULL则新分配一个
+*返回值：失败返回NULL
+*/
+MYSQL* SqlPool::connect(MYSQL* conn){
+    int host = hostOf(conn);
+    /* 初始化一个mysql对象 */
+    conn = mysql_init(conn);
+    if(conn == NULL){
+        LOG_ERROR("MYSQL init failed");
+        return NULL;
+    }
+    /* 建立conn到服务器本机的mysql数据库的连接 */
+    if(mysql_real_connect(conn, _urls[host].c_str(), _user.c_str(), _password.c_str(),
+           _database.c_str(), _ports[host], NULL, 0) == NULL){
+        LOG_ERROR("MYSQL connect to %s:%d failed", _urls[host].c_str(), _ports[host]);
+        mysql_close(conn);
+        return NULL;
+    }
+    if(conn >= _slots && conn < _slots + _maxConn){
+        /* 只有建立连接的线程持有该对象，交出连接时的加锁保证其他线程看到新值 */
+        _gens[conn - _slots]++;
+    }
+    return conn;
+}
+
+/*
+*功能：连接对象上建立连接的次数。连接池之外缓存了语句的模块(如批量插入)在使用连接前比较，
+*     变化了说明连接被原地重连过，旧语句已经失效
+*参数：
+*      --conn: 从连接池取得、正在使用的连接
+*返回值：不属于预先分配的连接对象(独占连接)时为0，这类连接不会原地重连
+*/
+unsigned SqlPool::generation(MYSQL* conn){
+    if(conn >= _slots && conn < _slots + _maxConn){
+        return _gens[conn - _slots];
+    }
+    return 0;
+}
+
+/*
+*功能：将建立好的连接放入池中
+*/
+void SqlPool::addConnection(MYSQL* conn){
+    locker.lock();
+    _connList.push_back(conn);
+    ++_freeConn;
+    locker.unlock();
+    _reserve.post();
+}
+
+void* SqlPool::maintainer(void* arg){
+    mysql_thread_init();
+    ((SqlPool*)arg)->maintain();
+    mysql_thread_end();
+    return NULL;
+}
+
+/*
+*功能：维护线程，建立尚未建立和断开后重连失败的连接，执行交来的任务，每HEALTH_INTERVAL检查一次空闲的连接
+*/
+void SqlPool::maintain(){
+    time_t nextCheck = time(NULL) + HEALTH_INTERVAL;
+    locker.lock();
+    while(!_stop){
+        while(!_broken.empty() && !_stop){
+            MYSQL* conn = _broken.front();
+            _broken.pop_front();
+            locker.unlock();
+            bool ok = (connect(conn) != NULL);
+            locker.lock();
+            if(!ok){
+                /* 稍后重试 */
+                _broken.push_back(conn);
+                break;
+            }
+            _connList.push_back(conn);
+            ++_freeConn;
+            _reserve.post();
+        }
+        while(!_jobs.empty() && !_stop){
+            pair<Job, void*> job = _jobs.front();
+            _jobs.pop_front();
+            _runningJob = job.second;
+            locker.unlock();
+            bool done = job.first(job.second);
+            locker.lock();
+            _runningJob = NULL;
+            _jobDone.broadcast();
+            if(!done){
+                /* 稍后重试 */
+                _jobs.push_back(job);
+                break;
+            }
+        }
+        if(time(NULL) >= nextCheck){
+            locker.unlock();
+            checkConnections();
+            locker.lock();
+            nextCheck = time(NULL) + HEALTH_INTERVAL;
+        }
+        struct timespec deadline;
+        deadline.tv_sec = (_broken.empty() && _jobs.empty()) ? nextCheck : time(NULL) + RECONNECT_INTERVAL;
+        deadline.tv_nsec = 0;
+        if(!_stop){
+            _wake.timewait(locker.getLock(), deadline);
+        }
+    }
+    locker.unlock();
+}
+
+/*
+*功能：将阻塞任务交给维护线程执行，任务返回false时每RECONNECT_INTERVAL重试一次
+*参数：
+*      --job: 任务函数，在维护线程中执行
+*      --arg: 任务的参数，也用于cancelJob
+*返回值：维护线程没有运行时返回false
+*/
+bool SqlPool::runLater(Job job, void* arg){
+    locker.lock();
+    bool running = (_slots != NULL && !_stop);
+    if(running){
+        _jobs.push_back(make_pair(job, arg));
+        _wake.signal();
+    }
+    locker.unlock();
+    return running;
+}
+
+/*
+*功能：取消参数为arg的任务，任务正在执行则等待其结束，之后arg可以被释放
+*/
+void SqlPool::cancelJob(void* arg){
+    locker.lock();
+    for(list<pair<Job, void*> >::iterator it = _jobs.begin(); it != _jobs.end(); ){
+        if(it->second == arg){
+            it = _jobs.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+    while(_runningJob == arg){
+        _jobDone.wait(locker.getLock());
+    }
+    locker.unlock();
+}
+
+/*
+*功能：ping当前空闲的连接，断开的连接关闭语句后原地重连，重连失败的交给维护线程稍后重试
+*/
+void SqlPool::checkConnections(){
+    locker.lock();
+    int num = _freeConn;
+    locker.unlock();
+    for(int i=0; i<num; ++i){
+        /* 没有空闲连接了，不和工作线程争抢 */
+        if(!_reserve.trywait()){
+            break;
+        }
+        locker.lock();
+        MYSQL* conn = _connList.front();
+        _connList.pop_front();
+        --_freeConn;
+        locker.unlock();
+        if(mysql_ping(conn) == 0){
+            addConnection(conn);
+            continue;
+        }
+        LOG_WARN("MYSQL connection lost:%s, reconnect", mysql_error(conn));
+        closeStatements(statements(conn));
+        mysql_close(conn);
+        if(connect(conn)){
+            addConnection(conn);
+        }
+        else{
+            locker.lock();
+            _broken.push_back(conn);
+            locker.unlock();
+        }
+    }
+}
+
+/*
+*功能：独占模式下，工作线程启动时调用，为本线程创建独占的连接。创建失败则本线程使用共享的连接
+*/
+void SqlPool::pinConnection(){
+    if(0 == _pinMode || _localConn){
+        return;
+    }
+    _localConn = connect();
+    _localBusy = false;
+    for(int i=0; i<STMT_NUM; ++i){
+        _localStmts[i] = NULL;
+    }
+}
+
+/*
+*功能：创建一个不属于连接池的连接，供长时间的查询使用，不占用池中的连接。由调用者mysql_close
+*返回值：失败返回NULL
+*/
+MYSQL* SqlPool::newConnection(){
+    return connect();
+}
+
+/*
+*功能：工作线程退出前调用，关闭本线程独占的连接
+*/
+void SqlPool::unpinConnection(){
+    if(_localConn){
+        closeStatements(_localStmts);
+        mysql_close(_localConn);
+        _localConn = NULL;
+    }
+}
+
+/*
+*功能：取得连接的语句缓存
+*/
+MYSQL_STMT** SqlPool::statements(MYSQL* conn){
+    if(conn == _localConn){
+        return _localStmts;
+    }
+    map<MYSQL*, MYSQL_STMT**>::iterator it = _stmts.find(conn);
+    return it == _stmts.end() ? NULL : it->second;
+}
+
+/*
+*功能：关闭缓存中的所有语句
+*/
+void SqlPool::closeStatements(MYSQL_STMT** stmts){
+    for(int i=0; i<STMT_NUM; ++i){
+        if(stmts[i]){
+            mysql_stmt_close(stmts[i]);
+            stmts[i] = NULL;
         }
-        /* 建立conn到服务器本机的mysql数据库的连接 */
-        conn = mysql_real_connect(conn, _url.c_str(), _user.c_str(), _password.c_str(),
-               _database.c_str(), _port, NULL, 0);
-        if(conn == NULL){
-            LOG_ERROR("MYSQL connect failed");
-            exit(1);
+    }
+}
+
+/*
+*功能：取得连接上预处理过的语句，第一次使用时预处理。调用者必须持有该连接
+*参数：
+*      --conn: getConnection()得到的连接
+*      --id: 语句编号
+*返回值：预处理失败返回NULL
+*/
+MYSQL_STMT* SqlPool::getStatement(MYSQL* conn, int id){
+    MYSQL_STMT** stmts = statements(conn);
+    if(stmts == NULL || id < 0 || id >= STMT_NUM){
+        return NULL;
+    }
+    if(stmts[id] == NULL){
+        MYSQL_STMT* stmt = mysql_stmt_init(conn);
+        if(stmt == NULL){
+            LOG_ERROR("mysql_stmt_init failed:%s", mysql_error(conn));
+            return NULL;
+        }
+        if(mysql_stmt_prepare(stmt, STMT_SQL[id], strlen(STMT_SQL[id]))){
+            LOG_ERROR("mysql_stmt_prepare failed:%s", mysql_stmt_error(stmt));
+            mysql_stmt_close(stmt);
+            return NULL;
         }
-        /* 将新建立的链接加入池中 */
-        _connList.push_back(conn);
-        ++_freeConn;
+        stmts[id] = stmt;
     }
+    return stmts[id];
+}
 
-    _reserve = Sem(_freeConn);
-    _maxConn = _freeConn;
+/*
+*功能：语句执行出错(如连接断开后重连)时丢弃缓存，下次使用时重新预处理
+*参数：
+*      --conn: 语句所在的连接
+*      --id: 语句编号
+*/
+void SqlPool::dropStatement(MYSQL* conn, int id){
+    MYSQL_STMT** stmts = statements(conn);
+    if(stmts == NULL || id < 0 || id >= STMT_NUM || stmts[id] == NULL){
+        return;
+    }
+    mysql_stmt_close(stmts[id]);
+    stmts[id] = NULL;
 }
 
 /*
@@ -59,8 +460,13 @@ void SqlPool::init(string url, string user, string password, string database,
 */
 MYSQL* SqlPool::getConnection(){
     MYSQL* conn = NULL;
-    /* 连接池中无对象 */
-    if(0 == _connList.size()){
+    /* 本线程有空闲的独占连接，直接使用。独占连接只属于主库 */
+    if(_pinMode && _localConn && !_localBusy){
+        _localBusy = true;
+        return _localConn;
+    }
+    /* 连接池中无对象。不能用_connList.size()判断，连接都被借出时链表也为空，应当阻塞等待 */
+    if(0 == _maxConn){
         return NULL;
     }
     /* 取出一个连接,如果没有空闲连接则阻塞 */
@@ -81,6 +487,11 @@ bool SqlPool::releaseConnection(MYSQL* conn){
     if(NULL == conn){
         return false;
     }
+    /* 独占的连接只需标记为空闲 */
+    if(conn == _localConn){
+        _localBusy = false;
+        return true;
+    }
 
     /* 释放, 放入链表中 */
     locker.lock();
@@ -96,15 +507,29 @@ bool SqlPool::releaseConnection(MYSQL* conn){
 *功能：销毁连接池，关闭连接，释放内存
 */
 void SqlPool::destroyPool(){
+    locker.lock();
+    bool running = (_slots != NULL && !_stop);
+    _stop = true;
+    _wake.signal();
+    locker.unlock();
+    if(running){
+        pthread_join(_maintainer, NULL);
+    }
+
     locker.lock();
     if(_connList.size() > 0){
         for(auto i=_connList.begin(); i!=_connList.end(); i++){
+            map<MYSQL*, MYSQL_STMT**>::iterator it = _stmts.find(*i);
+            if(it != _stmts.end()){
+                closeStatements(it->second);
+            }
             mysql_close(*i);
         }
         _curConn = 0;
         _freeConn = 0;
         _connList.clear();
     }
+    /* 借出的连接可能仍在工作线程中使用，连接对象和语句缓存不释放 */
     locker.unlock();
 }
 
@@ -8,29 +8,83 @@
 #ifndef SQLPOOL_H
 #define SQLPOOL_H
 
+/* make MARIADB=1时使用MariaDB Connector/C，头文件目录由pkg-config给出 */
+#ifdef USE_MARIADB
+#include <mysql.h>
+#include <errmsg.h>
+#else
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#endif
 #include <list>
+#include <map>
 #include <string>
+#include <vector>
+#include <atomic>
 
 #include "../log/log.h"
 #include "../locker/locker.h"
 using namespace std;
 
-/* 连接池类,创建一些sql连接供使用 */
+/* 健康检查的间隔，单位s */
+const int HEALTH_INTERVAL = 30;
+/* 连接失败后重试的间隔，单位s */
+const int RECONNECT_INTERVAL = 1;
+
+/* 连接池类,创建一些sql连接供使用。
+   启动时并行建立_minConn个连接后即可使用，其余的由维护线程在后台建立；
+   维护线程定期ping空闲的连接，断开的连接原地重连，也执行其他模块交来的阻塞任务。连接对象预先分配，重连后地址不变。
+   独占模式下每个工作线程启动时创建一个只属于自己的连接，取用和归还不加锁，
+   共享的链表只在独占连接创建失败或正在使用时作为补充。
+   每个连接带有预处理语句的缓存，语句在该连接上第一次使用时预处理，之后只传参数。
+   读写分离时有两个连接池：主库连接池执行注册的插入，只读副本连接池执行登录查询和启动时加载用户，
+   副本可以有多个，连接轮流分配到各个副本上 */
 class SqlPool{
 public:
+    /* 缓存的预处理语句编号 */
+    enum STMT_ID{
+        STMT_INSERT_USER = 0,  /* 注册用户 */
+        STMT_NUM
+    };
+    static const char* const STMT_SQL[STMT_NUM];  /* 预处理语句，按STMT_ID排列 */
+    /* 连接池的角色 */
+    enum ROLE{
+        PRIMARY = 0,  /* 主库，读写 */
+        REPLICA       /* 只读副本 */
+    };
+
     MYSQL* getConnection();
     bool releaseConnection(MYSQL* conn);
     int getFreeConnNum();
     void destroyPool();
     void init(string url, string user, string password, string database,
-             int port, int maxConn, int closeLog);
+             int port, int maxConn, int closeLog, int pinMode = 0, int minConn = 1);
+    void pinConnection();
+    void unpinConnection();
+    MYSQL* newConnection();
+    MYSQL_STMT* getStatement(MYSQL* conn, int id);
+    void dropStatement(MYSQL* conn, int id);
+    unsigned generation(MYSQL* conn);
+    /* 交给维护线程执行的阻塞任务，返回false表示稍后重试 */
+    typedef bool (*Job)(void* arg);
+    bool runLater(Job job, void* arg);
+    void cancelJob(void* arg);
 
-    static SqlPool* getInstance();
+    static SqlPool* getInstance(int role = PRIMARY);
+    static SqlPool* getReader();
 
 private:
     SqlPool();
     ~SqlPool();
+    MYSQL* connect(MYSQL* conn = NULL);
+    MYSQL_STMT** statements(MYSQL* conn);
+    void closeStatements(MYSQL_STMT** stmts);
+    void addConnection(MYSQL* conn);
+    int hostOf(MYSQL* conn);
+    static void* connector(void* arg);
+    static void* maintainer(void* arg);
+    void maintain();
+    void checkConnections();
 
     int _maxConn;  /* 最大连接数 */
     int _curConn;  /* 当前已使用连接数 */
@@ -38,10 +92,27 @@ private:
     list<MYSQL*> _connList;  /* 连接池 */
     Locker locker;   /* 用于多线程保护连接池 */
     Sem _reserve;   /* 信号量，表示空闲连接数 */
+    MYSQL* _slots;  /* 预先分配的连接对象，_maxConn个 */
+    unsigned* _gens;  /* 各个连接对象上建立连接的次数，原地重连后加1，其他模块据此丢弃旧连接上的语句 */
+    list<MYSQL*> _broken;   /* 未建立或已断开的连接，由维护线程重连 */
+    pthread_t _maintainer;  /* 维护线程 */
+    bool _stop;     /* 是否停止维护线程 */
+    Cond _wake;     /* 唤醒维护线程 */
+    list<pair<Job, void*> > _jobs;  /* 其他模块交给维护线程的阻塞任务，如异步客户端的重连 */
+    void* _runningJob;  /* 维护线程正在执行的任务的参数 */
+    Cond _jobDone;  /* 维护线程执行完一个任务 */
+    vector<string> _urls;   /* 各个数据库的主机地址，主库只有一个 */
+    vector<int> _ports;     /* 各个数据库的端口号 */
+    atomic<int> _nextHost;  /* 不属于_slots的连接轮流分配到各个数据库 */
+    int _pinMode;   /* 是否为每个工作线程创建独占的连接，0:否; 1:是 */
+    static thread_local MYSQL* _localConn;  /* 本线程独占的连接 */
+    static thread_local bool _localBusy;    /* 本线程独占的连接是否正在使用 */
+    map<MYSQL*, MYSQL_STMT**> _stmts;       /* 共享连接的语句缓存，以连接对象为键，init后不再增删，各项只由持有连接的线程修改 */
+    static thread_local MYSQL_STMT* _localStmts[STMT_NUM];  /* 本线程独占连接的语句缓存 */
 
 public:
-    string _url;   /* 主机地址 */
-    int _port;  /* 数据库端口号 */
+    string _url;   /* 主机地址，有多个时为第一个 */
+    int _port;  /* 数据库端口号，有多个时为第一个 */
     string _user;  /* 数据库用户名 */
     string _password; /* 用户密码 */
     string _database; /* 数据库名 */
@@ -0,0 +1,269 @@
+#include "userbatch.h"
+#include <time.h>
+#include <algorithm>
+
+UserBatch::UserBatch(){
+    _sqlPool = NULL;
+    _maxRows = 0;
+    _closeLog = 0;
+    _stop = false;
+}
+
+/*
+*功能：进程退出时停止提交线程，避免销毁仍有线程等待的条件变量
+*/
+UserBatch::~UserBatch(){
+    if(!enabled()){
+        return;
+    }
+    _locker.lock();
+    _stop = true;
+    _arrive.signal();
+    _locker.unlock();
+    pthread_join(_thread, NULL);
+    for(map<MYSQL*, ConnStmts>::iterator it = _stmts.begin(); it != _stmts.end(); ++it){
+        closeStatements(it->second);
+    }
+}
+
+/*
+*功能：关闭一个连接上缓存的全部语句
+*/
+void UserBatch::closeStatements(ConnStmts& cache){
+    for(map<int, MYSQL_STMT*>::iterator it = cache._stmts.begin(); it != cache._stmts.end(); ++it){
+        mysql_stmt_close(it->second);
+    }
+    cache._stmts.clear();
+}
+
+/*
+*功能：单例模式
+*/
+UserBatch* UserBatch::getInstance(){
+    static UserBatch userBatch;
+    return &userBatch;
+}
+
+/*
+*功能：开启批量插入，创建提交线程
+*参数：
+*      --sqlPool: 连接池，提交线程从中获取连接
+*      --maxRows: 每批的最大行数
+*      --closeLog: 日志开关
+*/
+void UserBatch::init(SqlPool* sqlPool, int maxRows, int closeLog){
+    _sqlPool = sqlPool;
+    _maxRows = maxRows;
+    _closeLog = closeLog;
+    if(pthread_create(&_thread, NULL, worker, this) != 0){
+        throw std::exception();
+    }
+}
+
+void* UserBatch::worker(void* arg){
+    mysql_thread_init();
+    ((UserBatch*)arg)->run();
+    mysql_thread_end();
+    return NULL;
+}
+
+/*
+*功能：插入一个用户，等待所在的批提交完成。不持有HttpConn的全局锁，多个请求可以同时等待
+*参数：
+*      --name: 用户名
+*      --password: 密码
+*返回值：0为成功
+*/
+int UserBatch::insert(const char* name, const char* password){
+    BatchItem item;
+    item._name = name;
+    item._password = password;
+    item._result = 1;
+    item._done = false;
+    _locker.lock();
+    _pending.push_back(&item);
+    _arrive.signal();
+    while(!item._done){
+        _finish.wait(_locker.getLock());
+    }
+    _locker.unlock();
+    return item._result;
+}
+
+/*
+*功能：提交线程，收集一批请求后提交。空闲时第一个请求到达后等待BATCH_WAIT，
+*     上一批提交期间已经有请求到达则立即提交
+*/
+void UserBatch::run(){
+    vector<BatchItem*> batch;
+    while(true){
+        _locker.lock();
+        bool idle = _pending.empty();
+        while(_pending.empty() && !_stop){
+            _arrive.wait(_locker.getLock());
+        }
+        if(_stop){
+            /* 未提交的请求以失败结束 */
+            for(size_t i=0; i<_pending.size(); ++i){
+                _pending[i]->_done = true;
+            }
+            _pending.clear();
+            _finish.broadcast();
+            _locker.unlock();
+            return;
+        }
+        if(idle){
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)BATCH_WAIT * 1000;
+            if(deadline.tv_nsec >= 1000000000){
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            while((int)_pending.size() < _maxRows){
+                if(!_arrive.timewait(_locker.getLock(), deadline)){
+                    break;
+                }
+            }
+        }
+        int num = min((int)_pending.size(), _maxRows);
+        batch.assign(_pending.begin(), _pending.begin() + num);
+        _pending.erase(_pending.begin(), _pending.begin() + num);
+        _locker.unlock();
+
+        flush(batch.data(), num);
+
+        _locker.lock();
+        for(int i=0; i<num; ++i){
+            batch[i]->_done = true;
+        }
+        _finish.broadcast();
+        _locker.unlock();
+    }
+}
+
+/*
+*功能：提交一批请求，设置每个请求的结果。整批失败时逐行重试
+*/
+void UserBatch::flush(BatchItem** items, int num){
+    MYSQL* conn = NULL;
+    ConnRAII mysqlCon(&conn, _sqlPool);
+    if(conn == NULL){
+        LOG_ERROR("%s", "batch INSERT: no connection");
+        return;
+    }
+    int ret = execute(conn, items, num);
+    if(0 == ret || 1 == num){
+        for(int i=0; i<num; ++i){
+            items[i]->_result = ret;
+        }
+        return;
+    }
+    LOG_WARN("batch INSERT of %d rows failed, retry row by row", num);
+    for(int i=0; i<num; ++i){
+        items[i]->_result = execute(conn, items + i, 1);
+    }
+}
+
+/*
+*功能：取得连接上num行的插入语句，第一次使用时预处理。
+*     连接被连接池的维护线程原地重连过时，缓存的语句属于已关闭的连接，全部丢弃后重新预处理
+*参数：
+*      --conn: 数据库连接
+*      --num: 行数
+*返回值：预处理失败返回NULL
+*/
+MYSQL_STMT* UserBatch::statement(MYSQL* conn, int num){
+    ConnStmts& cache = _stmts[conn];
+    unsigned gen = _sqlPool->generation(conn);
+    if(cache._gen != gen){
+        /* 旧连接关闭时语句已和它分离，mysql_stmt_close只释放语句自己的内存 */
+        closeStatements(cache);
+        cache._gen = gen;
+    }
+    map<int, MYSQL_STMT*>& stmts = cache._stmts;
+    map<int, MYSQL_STMT*>::iterator it = stmts.find(num);
+    if(it != stmts.end()){
+        return it->second;
+    }
+    string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+    for(int i=1; i<num; ++i){
+        sql += ",(?, ?)";
+    }
+    MYSQL_STMT* stmt = mysql_stmt_init(conn);
+    if(stmt == NULL){
+        LOG_ERROR("batch mysql_stmt_init failed:%s", mysql_error(conn));
+        return NULL;
+    }
+    if(mysql_stmt_prepare(stmt, sql.c_str(), sql.size())){
+        LOG_ERROR("batch mysql_stmt_prepare failed:%s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    stmts[num] = stmt;
+    return stmt;
+}
+
+/*
+*功能：丢弃连接上num行的插入语句，连接出错或被重连后语句失效，下次重新预处理
+*/
+void UserBatch::dropStatement(MYSQL* conn, int num){
+    map<int, MYSQL_STMT*>& stmts = _stmts[conn]._stmts;
+    map<int, MYSQL_STMT*>::iterator it = stmts.find(num);
+    if(it != stmts.end()){
+        mysql_stmt_close(it->second);
+        stmts.erase(it);
+    }
+}
+
+/*
+*功能：在一个事务中执行多行INSERT
+*参数：
+*      --conn: 数据库连接
+*      --items: 要插入的请求
+*      --num: 请求数量
+*返回值：0为成功
+*/
+int UserBatch::execute(MYSQL* conn, BatchItem** items, int num){
+    MYSQL_STMT* stmt = statement(conn, num);
+    if(stmt == NULL){
+        return 1;
+    }
+    vector<MYSQL_BIND> bind(2 * num);
+    vector<unsigned long> lens(2 * num);
+    memset(bind.data(), 0, sizeof(MYSQL_BIND) * bind.size());
+    for(int i=0; i<num; ++i){
+        const char* fields[2] = {items[i]->_name, items[i]->_password};
+        for(int j=0; j<2; ++j){
+            MYSQL_BIND& b = bind[2*i + j];
+            lens[2*i + j] = strlen(fields[j]);
+            b.buffer_type = MYSQL_TYPE_STRING;
+            b.buffer = (void*)fields[j];
+            b.buffer_length = lens[2*i + j];
+            b.length = &lens[2*i + j];
+        }
+    }
+    if(mysql_stmt_bind_param(stmt, bind.data())){
+        LOG_ERROR("batch bind error:%s", mysql_stmt_error(stmt));
+        dropStatement(conn, num);
+        return 1;
+    }
+    if(mysql_query(conn, "START TRANSACTION")){
+        LOG_ERROR("batch START TRANSACTION error:%s", mysql_error(conn));
+        return 1;
+    }
+    if(mysql_stmt_execute(stmt)){
+        LOG_ERROR("batch INSERT error:%s", mysql_stmt_error(stmt));
+        /* 客户端错误说明语句已经失效；重名等服务器错误不影响语句 */
+        if(mysql_stmt_errno(stmt) >= CR_MIN_ERROR){
+            dropStatement(conn, num);
+        }
+        mysql_rollback(conn);
+        return 1;
+    }
+    if(mysql_commit(conn)){
+        LOG_ERROR("batch COMMIT error:%s", mysql_error(conn));
+        return 1;
+    }
+    return 0;
+}
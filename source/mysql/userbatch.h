@@ -0,0 +1,75 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-19
+@Detail    : 注册用户的批量插入，多个请求的插入合并为一条多行INSERT，在一个事务中提交
+@Reference : https://dev.mysql.com/doc/refman/8.0/en/insert-optimization.html
+*/
+
+#ifndef USERBATCH_H
+#define USERBATCH_H
+
+#include <pthread.h>
+#include <vector>
+#include <string>
+#include <map>
+#include "sqlpool.h"
+#include "../locker/locker.h"
+using namespace std;
+
+/* 第一个注册请求到达后，等待更多请求加入同一批的最长时间，单位us */
+const int BATCH_WAIT = 2000;
+
+/* 一个等待插入的注册请求，位于发起请求的工作线程的栈上 */
+struct BatchItem{
+    const char* _name;      /* 用户名 */
+    const char* _password;  /* 密码 */
+    int _result;            /* 插入结果，0为成功 */
+    bool _done;             /* 是否已经提交 */
+};
+
+/* 批量插入类：工作线程调用insert()后等待，由单独的提交线程收集请求，
+   凑够_maxRows行或等待BATCH_WAIT后执行一条多行INSERT。多行INSERT按行数预处理后缓存在各个连接上，
+   用户名和密码以参数传入，不拼接SQL。提交期间到达的请求组成下一批，
+   注册的吞吐量由批的大小决定，而不是每个请求一次往返。
+   整批失败(例如其中一个用户名重复)时逐行重试，每个请求得到自己的结果 */
+class UserBatch{
+public:
+    static UserBatch* getInstance();
+    void init(SqlPool* sqlPool, int maxRows, int closeLog);
+    /* 是否开启了批量插入 */
+    bool enabled(){
+        return _maxRows > 0;
+    }
+    int insert(const char* name, const char* password);
+
+private:
+    /* 一个连接上预处理的多行插入 */
+    struct ConnStmts{
+        ConnStmts():_gen(0){}
+        unsigned _gen;                  /* 预处理时连接的SqlPool::generation()，连接重连后不再相等 */
+        map<int, MYSQL_STMT*> _stmts;   /* 以行数为键 */
+    };
+
+    UserBatch();
+    ~UserBatch();
+    static void* worker(void* arg);
+    void run();
+    void flush(BatchItem** items, int num);
+    int execute(MYSQL* conn, BatchItem** items, int num);
+    MYSQL_STMT* statement(MYSQL* conn, int num);
+    void dropStatement(MYSQL* conn, int num);
+    static void closeStatements(ConnStmts& cache);
+
+    SqlPool* _sqlPool;            /* 提交线程从中获取连接 */
+    int _maxRows;                 /* 每批的最大行数，0表示不开启 */
+    vector<BatchItem*> _pending;  /* 等待提交的请求 */
+    Locker _locker;               /* 保护_pending和各请求的_done */
+    Cond _arrive;                 /* 有新的请求到达 */
+    Cond _finish;                 /* 一批请求提交完成 */
+    pthread_t _thread;            /* 提交线程 */
+    bool _stop;                   /* 是否停止提交线程 */
+    int _closeLog;                /* 日志开关 */
+    map<MYSQL*, ConnStmts> _stmts;  /* 各连接上预处理的多行插入，只由提交线程使用 */
+};
+
+#endif
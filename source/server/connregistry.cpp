@@ -0,0 +1,64 @@
+#include "connregistry.h"
+
+ConnRegistry::ConnRegistry(){
+    _chunks = NULL;
+    _chunkNum = 0;
+    _maxConn = 0;
+}
+
+ConnRegistry::~ConnRegistry(){
+    for(int i=0; i<_chunkNum; ++i){
+        delete[] _chunks[i].load(memory_order_relaxed);
+    }
+    delete[] _chunks;
+}
+
+/*
+*  功能：将文件描述符的软限制提高到硬限制，并据此确定连接表的容量，只分配块指针数组
+*/
+void ConnRegistry::init(){
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0){
+        if(limit.rlim_cur < limit.rlim_max){
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+        _maxConn = limit.rlim_cur > (rlim_t)MAX_CONN_LIMIT ? MAX_CONN_LIMIT : (int)limit.rlim_cur;
+    }
+    else{
+        _maxConn = CHUNK_SIZE;
+    }
+
+    _chunkNum = (_maxConn + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    _chunks = new atomic<Conn*>[_chunkNum];
+    for(int i=0; i<_chunkNum; ++i){
+        _chunks[i].store(NULL, memory_order_relaxed);
+    }
+}
+
+/*
+*  功能：取得fd对应的连接，所在的块还没有分配则分配。多个事件循环可能同时分配同一块，
+*       通过CAS只保留一个
+*  参数：
+*        --fd: 连接的文件描述符
+*  返回值：fd超出上限返回NULL
+*/
+Conn* ConnRegistry::get(int fd){
+    if(fd < 0 || fd >= _maxConn){
+        return NULL;
+    }
+    atomic<Conn*>& slot = _chunks[fd >> CHUNK_SHIFT];
+    Conn* chunk = slot.load(memory_order_acquire);
+    if(chunk == NULL){
+        Conn* newChunk = new Conn[CHUNK_SIZE];
+        if(slot.compare_exchange_strong(chunk, newChunk, memory_order_acq_rel)){
+            chunk = newChunk;
+        }
+        else{
+            /* 其他循环已经分配了，chunk中是它分配的块 */
+            delete[] newChunk;
+        }
+    }
+    return chunk + (fd & (CHUNK_SIZE - 1));
+}
@@ -0,0 +1,62 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-15
+@Detail    : 连接表，按fd分块管理连接，块在第一次使用时才分配，上限由RLIMIT_NOFILE决定
+@Reference : https://github.com/qinguoyi/TinyWebServer
+*/
+
+#ifndef CONNREGISTRY_H
+#define CONNREGISTRY_H
+
+#include <atomic>
+#include <string>
+#include <sys/resource.h>
+#include "../http/httpconn.h"
+#include "../timer/twTimer.h"
+using namespace std;
+
+/* 连接表的容量上限，即使RLIMIT_NOFILE更大也不超过它 */
+const int MAX_CONN_LIMIT = 1 << 22;
+
+/* 一个fd上的连接的全部状态 */
+struct Conn{
+    Conn():_http(), _client(), _gen(0){}
+
+    HttpConn _http;          /* http连接 */
+    ClientData _client;      /* 定时器数据 */
+    unsigned _gen;           /* 连接的代数，fd每被一个新连接使用一次加1，旧连接的事件不再匹配 */
+    string _pending;         /* io_uring后端，处理期间收到的数据，处理结束后再交给连接 */
+};
+
+/* 连接表：按fd索引，每CONN_CHUNK_SIZE个fd为一块。块在该范围的fd第一次被使用时才分配，
+   之后不再释放，因此Conn的地址不会改变，各个事件循环可以无锁访问各自的连接 */
+class ConnRegistry{
+public:
+    ConnRegistry();
+    ~ConnRegistry();
+
+    void init();
+    Conn* get(int fd);
+    /* 取得fd对应的连接，所在的块还没有分配则返回NULL */
+    Conn* find(int fd){
+        if(fd < 0 || fd >= _maxConn){
+            return NULL;
+        }
+        Conn* chunk = _chunks[fd >> CHUNK_SHIFT].load(memory_order_acquire);
+        return chunk ? chunk + (fd & (CHUNK_SIZE - 1)) : NULL;
+    }
+    /* 能够容纳的连接数量，即fd的上限 */
+    int maxConn(){
+        return _maxConn;
+    }
+
+private:
+    static const int CHUNK_SHIFT = 10;
+    static const int CHUNK_SIZE = 1 << CHUNK_SHIFT;  /* 每块的连接数 */
+
+    atomic<Conn*>* _chunks;  /* 块指针数组 */
+    int _chunkNum;           /* 块的数量 */
+    int _maxConn;            /* fd的上限 */
+};
+
+#endif
@@ -0,0 +1,848 @@
+#include "eventloop.h"
+#include "webserver.h"
+
+EventLoop::EventLoop(){
+    _id = 0;
+    _epollFd = -1;
+    _listenFd = -1;
+    _pipeFd[0] = -1;
+    _pipeFd[1] = -1;
+    _timerFd = -1;
+    _signalFd = -1;
+    _timerTicks = 0;
+    _wakeFd = -1;
+    _server = NULL;
+    _conns = NULL;
+    _closeLog = 0;
+    _pendingConns = NULL;
+    _nextLoop = 1;
+    _acceptPaused = false;
+    _eventFd = -1;
+    _tid = 0;
+    _ring = NULL;
+    _bufRecycled = false;
+    _connEvents = NULL;
+    _asyncSql = NULL;
+}
+
+EventLoop::~EventLoop(){
+    if(_wakeFd != -1) close(_wakeFd);
+    if(_timerFd != -1) close(_timerFd);
+    if(_signalFd != -1) close(_signalFd);
+    if(_eventFd != -1) close(_eventFd);
+    delete _pendingConns;
+    delete _connEvents;
+    delete _asyncSql;
+    delete _ring;
+    if(_epollFd != -1) close(_epollFd);
+    if(_listenFd != -1) close(_listenFd);
+    if(_pipeFd[1] != -1) close(_pipeFd[1]);
+    if(_pipeFd[0] != -1) close(_pipeFd[0]);
+}
+
+/*
+*  功能：绑定所属的服务器
+*  参数：
+*        --server: 服务器
+*        --id: 事件循环的编号
+*/
+void EventLoop::init(WebServer* server, int id){
+    _server = server;
+    _id = id;
+    _conns = server->_conns;
+    _closeLog = server->_closeLog;
+    _utils.init(SortTimerWheel::SI);
+}
+
+/*
+*  功能：创建epoll内核事件表(或io_uring)、信号管道和timerfd, 0号循环还创建signalfd。
+*       SO_REUSEPORT模式下每个循环都创建监听socket；主从Reactor模式下只有主循环监听，
+*       从循环创建eventfd, 用于接收主循环交来的新连接
+*/
+void EventLoop::eventListen(){
+    int ret = -1;
+    bool subLoop = (1 == _server->_dispatchMode && _id != 0);
+
+    if(!subLoop){
+        createListenFd();
+    }
+
+    /* 创建一对socket,用于接收0号循环转发的信号 */
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, _pipeFd);
+    assert(ret == 0);
+    _utils.setNonblocking(_pipeFd[1]);
+
+    /* 创建timerfd, 每个时间片到期一次，驱动时间轮 */
+    _timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    assert(_timerFd != -1);
+    struct itimerspec spec;
+    spec.it_value.tv_sec = _utils._timeSlot / 1000;
+    spec.it_value.tv_nsec = (long)(_utils._timeSlot % 1000) * 1000000;
+    spec.it_interval = spec.it_value;
+    ret = timerfd_settime(_timerFd, 0, &spec, NULL);
+    assert(ret == 0);
+
+    if(0 == _id){
+        /* 信号已在所有线程中屏蔽，由0号循环通过signalfd读取 */
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        _signalFd = signalfd(-1, &mask, SFD_CLOEXEC);
+        assert(_signalFd != -1);
+    }
+
+    if(subLoop){
+        /* 新连接队列和唤醒用的eventfd */
+        _pendingConns = new LockFreeQueue<PendingConn>(MAX_PENDING_CONN);
+        _wakeFd = eventfd(0, EFD_CLOEXEC);
+        assert(_wakeFd != -1);
+    }
+
+    if(_server->_asyncSqlNum > 0 && !(1 == _server->_dispatchMode && 0 == _id)){
+        /* 有客户连接的循环创建异步数据库客户端，不可用时注册请求仍由工作线程同步插入 */
+        _asyncSql = new AsyncSql();
+        if(!_asyncSql->init(SqlPool::getInstance(), _server->_asyncSqlNum, MAX_SQL_WAIT)){
+            LOG_ERROR("event loop %d: async sql disabled", _id);
+            delete _asyncSql;
+            _asyncSql = NULL;
+        }
+    }
+
+    /* 工作线程交回的连接事件队列和唤醒用的eventfd。工作线程处理完总是将连接交回事件循环，
+       由事件循环重置EPOLLONESHOT或关闭连接，处理期间到期的连接也在交回时才关闭 */
+    _connEvents = new LockFreeQueue<ConnEvent>(MAX_CONN_EVENT);
+    _eventFd = eventfd(0, EFD_CLOEXEC);
+    assert(_eventFd != -1);
+
+    if(1 == _server->_ioMode){
+        uringListen();
+        return;
+    }
+
+    /* 创建epoll内核事件表 */
+    _epollFd = epoll_create(1);
+    assert(_epollFd != -1);
+    if(_listenFd != -1){
+        /* 将监听socket加入epoll中 */
+        _utils.addFd(_epollFd, _listenFd,false, _server->_listenTrigMode);
+    }
+    _utils.addFd(_epollFd, _pipeFd[0], false, 0);
+    _utils.addFd(_epollFd, _timerFd, false, 0);
+    if(_signalFd != -1){
+        _utils.addFd(_epollFd, _signalFd, false, 0);
+    }
+    if(_wakeFd != -1){
+        _utils.addFd(_epollFd, _wakeFd, false, 0);
+    }
+    if(_eventFd != -1){
+        _utils.addFd(_epollFd, _eventFd, false, 0);
+    }
+}
+
+/*
+*  功能：创建监听socket
+*/
+void EventLoop::createListenFd(){
+    /* 创建监听socket */
+    _listenFd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(_listenFd >= 0);
+
+    if(0 == _server->_optLinger){
+        /* 不使用优雅关闭连接，即close时会立即关闭，不会等待剩余数据的传送 */
+        struct linger tmp = {0,1};
+        setsockopt(_listenFd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+    }
+    else{
+        /* 使用优雅关闭连接，即close时会延时1秒，等待剩余数据的传送 */
+        struct linger tmp = {1,1};
+        setsockopt(_listenFd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+    }
+
+    int ret = -1;
+    /* 设置服务器监听地址 */
+    struct sockaddr_in address;
+    bzero(&address,sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(_server->_port);
+
+    int flag = 1;
+    /* 设置端口复用 */
+    setsockopt(_listenFd,SOL_SOCKET,SO_REUSEADDR,&flag,sizeof(flag));
+    if(0 == _server->_dispatchMode && _server->_loopNum > 1){
+        /* 多个事件循环绑定同一端口，由内核在各个监听socket之间分配新连接 */
+        ret = setsockopt(_listenFd,SOL_SOCKET,SO_REUSEPORT,&flag,sizeof(flag));
+        assert(ret == 0);
+    }
+    /* 将_listenFd与本地的IP+PORT绑定 */
+    ret = bind(_listenFd,(struct sockaddr*)&address,sizeof(address));
+    assert(ret >= 0);
+    /* 监听 */
+    ret = listen(_listenFd,5);
+    assert(ret >= 0);
+}
+
+/*
+*  功能：创建线程运行事件循环
+*/
+void EventLoop::start(){
+    if(pthread_create(&_thread, NULL, worker, this) != 0){
+        throw std::exception();
+    }
+}
+
+/*
+*  功能：等待事件循环线程结束
+*/
+void EventLoop::join(){
+    pthread_join(_thread, NULL);
+}
+
+/*
+*  功能：线程处理函数
+*  参数：
+*       --arg：事件循环对象的指针
+*/
+void* EventLoop::worker(void* arg){
+    EventLoop* loop = (EventLoop*)arg;
+    loop->loop();
+    return loop;
+}
+
+/*
+*  功能：处理到来的事件
+*/
+void EventLoop::loop(){
+    _tid = pthread_self();
+    if(_ring){
+        uringLoop();
+        return;
+    }
+
+    bool timeOut = false;     /* 是否超时 */
+    bool stopServer = false;  /* 是否停止服务 */
+
+    while(!stopServer){
+        /* 监测事件, 阻塞 */
+        int number = epoll_wait(_epollFd, _events, MAX_EVENT_NUMBER, _acceptPaused ? ACCEPT_PAUSE_CHECK : -1);
+        if(number < 0 && errno != EINTR){
+            LOG_ERROR("%s", "epoll failure");
+            break;
+        }
+        /* 线程池过载时暂停接受新连接，恢复后继续 */
+        checkAccept();
+        /* 处理I/O事件 */
+        for(int i=0; i<number; i++){
+            /* 客户连接的data为代数(高32位)+fd(低32位)，其他fd的代数为0 */
+            int sockFd = (int)(_events[i].data.u64 & 0xffffffff);
+            unsigned gen = (unsigned)(_events[i].data.u64 >> 32);
+            if(gen != 0){
+                Conn* conn = _conns->find(sockFd);
+                if(conn == NULL || conn->_gen != gen || conn->_client._timer == NULL){
+                    /* 连接已经关闭，fd可能被新连接重用了 */
+                    continue;
+                }
+                if(_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                    /* 客户端关闭连接，调用回调函数（将sockFd移除epoll监听）, 删除对应的定时器 */
+                    dealTimer(conn);
+                }
+                else if(_events[i].events & EPOLLIN){
+                    /* 客户连接上发来新的数据 */
+                    dealWithRead(conn);
+                }
+                else if(_events[i].events & EPOLLOUT){
+                    /* 写缓冲区由满变成未满，触发EPOLLOUT，将响应写回 */
+                    dealWithWrite(conn);
+                }
+            }
+            else if(sockFd == _listenFd && !_acceptPaused){
+                /* 有新的连接 */
+                bool flag = dealClientData();
+                if(!flag)
+                    continue;
+            }
+            else if((sockFd == _timerFd) && (_events[i].events & EPOLLIN)){
+                /* 时间片到期 */
+                dealWithTimer(timeOut);
+            }
+            else if((sockFd == _signalFd) && (_events[i].events & EPOLLIN)){
+                /* 处理信号 */
+                dealWithSignalFd(stopServer);
+            }
+            else if((sockFd == _pipeFd[0]) && (_events[i].events & EPOLLIN)){
+                /* 处理0号循环转发的信号 */
+                dealWithSignal(stopServer);
+            }
+            else if((sockFd == _wakeFd) && (_events[i].events & EPOLLIN)){
+                /* 主循环交来了新的连接 */
+                dealWithConn();
+            }
+            else if((sockFd == _eventFd) && (_events[i].events & EPOLLIN)){
+                /* 工作线程交回了连接事件 */
+                dealWithEvents();
+            }
+            else if(_asyncSql && _asyncSql->resume(sockFd, _events[i].events)){
+                /* 数据库连接就绪，继续执行查询 */
+                dealWithSql();
+            }
+        }
+        /* 超时，I/O处理结束后再删除超时任务 */
+        if(timeOut){
+            _utils.timerHandler(_timerTicks);
+            if(0 == _id){
+                /* 会话的时间轮由0号循环驱动 */
+                SessionTable::getInstance()->tick(_timerTicks);
+            }
+            if(_asyncSql){
+                /* 取回维护线程重连好的数据库连接 */
+                _asyncSql->tick();
+                dealWithSql();
+            }
+            timeOut = false;
+        }
+    }
+}
+
+/*
+*  功能：处理新的连接
+*  返回值：成功： true; 失败： false.
+*/
+bool EventLoop::dealClientData(){
+    struct sockaddr_in clientAddr;
+    socklen_t clientAddrLen = sizeof(clientAddr);
+    if(0 == _server->_listenTrigMode){
+        /* LT */
+        int httpFd = accept4(_listenFd, (struct sockaddr*)&clientAddr, &clientAddrLen, SOCK_NONBLOCK);
+        if(httpFd == -1){
+            LOG_ERROR("%s, errno is %d", "accept error", errno);
+            return false;
+        }
+        if(HttpConn::_userCount >= _conns->maxConn()){
+            _utils.showError(httpFd, "Interval server is busy");
+            LOG_ERROR("%s", "Interval server is busy");
+            return false;
+        }
+        /* 初始化客户端连接，或交给从循环 */
+        return dispatchConn(httpFd, clientAddr);
+    }
+    else{
+        /* ET */
+        while(1){
+            int httpFd = accept4(_listenFd, (struct sockaddr*)&clientAddr, &clientAddrLen, SOCK_NONBLOCK);
+            if(httpFd < 0){
+                if(errno != EAGAIN){
+                    LOG_ERROR("%s, errno is %d", "accept error", errno);
+                    return false;
+                }
+                break;
+            }
+            if(HttpConn::_userCount >= _conns->maxConn()){
+                _utils.showError(httpFd, "Interval server is busy");
+                LOG_ERROR("%s", "Interval server is busy");
+                return false;
+            }
+            /* 初始化客户端连接，或交给从循环 */
+            if(!dispatchConn(httpFd, clientAddr)){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+*  功能：分发新的连接。SO_REUSEPORT模式下由本循环处理；
+*       主从Reactor模式下轮流交给各个从循环
+*  参数：
+*       --httpFd: 客户连接的socket
+*       --addr: 客户地址
+*  返回值：成功： true; 失败： false.
+*/
+bool EventLoop::dispatchConn(int httpFd, const sockaddr_in& addr){
+    if(0 == _server->_dispatchMode){
+        addConn(httpFd, addr);
+        return true;
+    }
+
+    /* 轮询选择从循环，0号是主循环自己 */
+    EventLoop* sub = _server->_loops + _nextLoop;
+    _nextLoop = _nextLoop + 1 < _server->_loopNum ? _nextLoop + 1 : 1;
+    if(!sub->queueConn(httpFd, addr)){
+        _utils.showError(httpFd, "Interval server is busy");
+        LOG_ERROR("%s", "Interval server is busy");
+        return false;
+    }
+    return true;
+}
+
+/*
+*  功能：主循环调用，将新连接放入本循环的队列，并通过eventfd唤醒本循环
+*  参数：
+*       --httpFd: 客户连接的socket
+*       --addr: 客户地址
+*  返回值：队列已满返回false
+*/
+bool EventLoop::queueConn(int httpFd, const sockaddr_in& addr){
+    PendingConn conn;
+    conn._sockFd = httpFd;
+    conn._address = addr;
+    if(!_pendingConns->push(conn)){
+        return false;
+    }
+    uint64_t one = 1;
+    ::write(_wakeFd, &one, sizeof(one));
+    return true;
+}
+
+/*
+*  功能：从循环被唤醒，取出主循环交来的所有新连接并初始化
+*/
+void EventLoop::dealWithConn(){
+    uint64_t count;
+    ::read(_wakeFd, &count, sizeof(count));
+    addPendingConns();
+}
+
+/*
+*  功能：取出主循环交来的所有新连接并初始化
+*/
+void EventLoop::addPendingConns(){
+    PendingConn conn;
+    while(_pendingConns->pop(conn)){
+        addConn(conn._sockFd, conn._address);
+    }
+}
+
+/*
+*  功能：工作线程调用，将连接接下来等待的事件交回本循环，并通过eventfd唤醒本循环
+*  参数：
+*       --sockFd: 客户连接的socket
+*       --gen: 连接的代数
+*       --event: 连接接下来等待的事件
+*/
+void EventLoop::postEvent(int sockFd, unsigned gen, int event){
+    ConnEvent connEvent;
+    connEvent._sockFd = sockFd;
+    connEvent._gen = gen;
+    connEvent._event = event;
+    /* 事件不能丢弃，队列满时等待事件循环取走 */
+    while(!_connEvents->push(connEvent)){
+        sched_yield();
+    }
+    uint64_t one = 1;
+    ::write(_eventFd, &one, sizeof(one));
+}
+
+/*
+*  功能：取出工作线程交回的连接事件，重置EPOLLONESHOT或关闭连接，epoll后端使用
+*/
+void EventLoop::dealWithEvents(){
+    uint64_t count;
+    ::read(_eventFd, &count, sizeof(count));
+    ConnEvent connEvent;
+    while(_connEvents->pop(connEvent)){
+        Conn* conn = _conns->find(connEvent._sockFd);
+        if(conn->_gen != connEvent._gen || !releaseConn(conn)){
+            /* 处理期间连接已经超时，现在关闭 */
+            continue;
+        }
+        if(0 == connEvent._event){
+            /* 处理失败，删除定时器，关闭socket */
+            dealTimer(conn);
+        }
+        else if(CONN_EVENT_SQL == connEvent._event){
+            /* 异步执行数据库查询，完成前连接仍处于处理中 */
+            conn->_client._busy = true;
+            startSql(conn, connEvent._sockFd);
+        }
+        else{
+            conn->_http.modFd(_epollFd, connEvent._sockFd, connEvent._event, _server->_httpTrigMode);
+        }
+    }
+}
+
+/*
+*  功能：初始化客户端连接和定时器，连接加入本循环的epoll
+*  参数：
+*       --httpFd: 客户连接的socket
+*       --addr: 客户地址
+*/
+void EventLoop::addConn(int httpFd, const sockaddr_in& addr){
+    Conn* conn = _conns->get(httpFd);
+    if(conn == NULL){
+        /* fd超出了连接表的上限 */
+        _utils.showError(httpFd, "Interval server is busy");
+        LOG_ERROR("%s", "Interval server is busy");
+        return;
+    }
+    /* 新的代数，0留给非连接的fd */
+    conn->_gen++;
+    if(conn->_gen == 0){
+        conn->_gen = 1;
+    }
+    /* 初始化客户端连接数据 */
+    conn->_http.init(httpFd, conn->_gen, addr, this, _server->_root, _server->_httpTrigMode,
+        _closeLog);
+    /* 初始化定时器 */
+    setTimer(conn, httpFd, addr);
+    if(_ring){
+        uringAddConn(conn, httpFd);
+    }
+}
+
+/*
+*  功能：绑定客户数据，创建定时器，设置回调函数和超时时间，将定时器加入本循环的时间轮
+*  参数：
+*       --conn: 连接
+*       --httFd: 客户连接的socket
+*       --addr: 客户地址
+*/
+void EventLoop::setTimer(Conn* conn, int httpFd, struct sockaddr_in addr){
+    ClientData* client = &conn->_client;
+    if(client->_timer){
+        /* fd上一个连接的定时器仍在时间轮中，先删除，不能让它到期时关闭新连接 */
+        _utils._timerList.deleteTimer(client->_timer);
+        client->_timer = NULL;
+    }
+    client->_address = addr;
+    client->_sockFd = httpFd;
+    client->_epollFd = _epollFd;
+    client->_busy = false;
+    client->_closing = false;
+    client->_timer = _utils._timerList.addTimer(3*TIME_SLOT);
+    client->_timer->_userData = client;
+    client->_timer->_cbFunc = cb_func;
+}
+
+/*
+*  功能：连接交还事件循环，不再处于处理中。处理期间定时器到期的连接在这里关闭
+*  参数：
+*       --conn: 客户连接，代数和交还的事件相同
+*  返回值：连接仍然存在返回true
+*/
+bool EventLoop::releaseConn(Conn* conn){
+    ClientData* client = &conn->_client;
+    client->_busy = false;
+    if(client->_timer){
+        return true;
+    }
+    if(client->_closing){
+        /* socket已经在到期时shutdown，定时器已经删除 */
+        close_func(client);
+        LOG_INFO("close expired fd %d", client->_sockFd);
+    }
+    return false;
+}
+
+/*
+*  功能：调用定时器的回调函数关闭连接，将定时器移除时间轮
+*  参数：
+*       --conn: 需要关闭的连接
+*/
+void EventLoop::dealTimer(Conn* conn){
+    UtilTimer* timer = conn->_client._timer;
+    /* 连接已经被关闭 */
+    if(!timer){
+        return;
+    }
+    timer->_cbFunc(timer->_userData);
+    _utils._timerList.deleteTimer(timer);
+    LOG_INFO("close fd %d", conn->_client._sockFd);
+}
+
+/*
+*  功能：timerfd到期，表明可能有任务超时，设置超时，I/O处理结束，再删除超时任务
+*  参数：
+*       --timeOut: 传出参数，是否有超时任务
+*/
+void EventLoop::dealWithTimer(bool& timeOut){
+    if(::read(_timerFd, &_timerTicks, sizeof(_timerTicks)) != sizeof(_timerTicks)){
+        return;
+    }
+    timeOut = true;
+}
+
+/*
+*  功能：0号循环读取signalfd
+*  参数：
+*       --stopServer：传出参数，是否终止服务器
+*/
+void EventLoop::dealWithSignalFd(bool& stopServer){
+    int ret = ::read(_signalFd, _sigInfos, sizeof(_sigInfos));
+    if(ret <= 0){
+        LOG_ERROR("%s","read signal failed");
+        return;
+    }
+    dealWithSignalInfo(_sigInfos, ret / sizeof(signalfd_siginfo), stopServer);
+}
+
+/*
+*  功能：0号循环处理signalfd读到的信号，并转发给其他循环
+*       SIGTERM: 终止服务器
+*  参数：
+*       --infos: 信号
+*       --num: 信号个数
+*       --stopServer：传出参数，是否终止服务器
+*/
+void EventLoop::dealWithSignalInfo(const signalfd_siginfo* infos, int num, bool& stopServer){
+    for(int i=0; i<num; i++){
+        char sig = (char)infos[i].ssi_signo;
+        for(int j=1; j<_server->_loopNum; j++){
+            send(_server->_loops[j]._pipeFd[1], &sig, 1, 0);
+        }
+        dealWithSignals(&sig, 1, stopServer);
+    }
+}
+
+/*
+*  功能：读取0号循环转发的信号
+*  参数：
+*       --stopServer：传出参数，是否终止服务器
+*/
+void EventLoop::dealWithSignal(bool& stopServer){
+    int ret = 0;
+    char signals[1024];
+    ret = recv(_pipeFd[0], signals, sizeof(signals), 0);
+    if(ret == -1 || ret == 0){
+        LOG_ERROR("%s","read signal failed");
+        return;
+    }
+    dealWithSignals(signals, ret, stopServer);
+}
+
+/*
+*  功能：依次处理信号
+*       SIGTERM: 终止服务器
+*  参数：
+*       --signals: 信号
+*       --num: 信号个数
+*       --stopServer：传出参数，是否终止服务器
+*/
+void EventLoop::dealWithSignals(const char* signals, int num, bool& stopServer){
+    for(int i=0; i<num; i++){
+        switch(signals[i]){
+            case SIGTERM:
+            {
+                stopServer = true;
+                break;
+            }
+        }
+    }
+}
+
+/*
+*  功能：读取客户发送的数据
+*  参数：
+*       --conn: 客户连接
+*/
+void EventLoop::dealWithRead(Conn* conn){
+
+   UtilTimer* timer = conn->_client._timer;
+
+   if(1 == _server->_actorMode){
+       /*  reactor */
+        /* 将读取事件放入请求队列，处理结果由工作线程交回，不在这里等待 */
+        if(!_server->_threadsPool->append(&conn->_http, 0)){
+            /* 请求队列已满，返回503并关闭连接 */
+            rejectConn(conn, true);
+            return;
+        }
+        /* 连接交给了工作线程，交回之前定时器到期也不能关闭 */
+        conn->_client._busy = true;
+        /* 有数据传输，则连接重置活跃监测时间 */
+        adjustTimer(timer);
+   }
+   else{
+        /* proactor */
+        /* 读取数据 */
+        if(conn->_http.readOnce()){
+            LOG_INFO("deal with the client(%s)",
+               inet_ntoa(conn->_http.getAddress()->sin_addr));
+
+            /* 放入请求队列，队列已满则返回503并关闭连接 */
+            if(!_server->_threadsPool->appendP(&conn->_http)){
+                rejectConn(conn, true);
+                return;
+            }
+            conn->_client._busy = true;
+
+            /* 有数据传输，则连接重置活跃监测时间 */
+            adjustTimer(timer);
+        }
+        else{
+           /* 读失败，删除定时器，关闭socket */
+           dealTimer(conn);
+        }
+   }
+}
+
+/*
+*  功能：向客户端发送数据
+*  参数：
+*       --conn: 客户连接
+*/
+void EventLoop::dealWithWrite(Conn* conn){
+    UtilTimer* timer = conn->_client._timer;
+
+    if(1 == _server->_actorMode){
+        /* reactor */
+        /* 添加至请求队列，处理结果由工作线程交回，不在这里等待 */
+        if(!_server->_threadsPool->append(&conn->_http, 1)){
+            /* 响应已经发送了一部分，不能再发送503，直接关闭连接 */
+            rejectConn(conn, false);
+            return;
+        }
+        conn->_client._busy = true;
+        /* 执行了I/O事件，活跃检测时间重置 */
+        adjustTimer(timer);
+    }
+    else{
+        /* proactor */
+        /* 写数据 */
+        if(conn->_http.write()){
+            LOG_INFO("send data to the client(%s)",
+               inet_ntoa(conn->_http.getAddress()->sin_addr));
+
+            /* 执行了I/O事件，活跃检测时间重置 */
+            adjustTimer(timer);
+        }
+        else{
+           /* 写失败，删除定时器，关闭socket */
+           dealTimer(conn);
+        }
+    }
+}
+
+/*
+*  功能：有数据传输，则连接重置活跃监测时间
+*  参数：
+*       --timer: 需要处理的定时器
+*/
+void EventLoop::adjustTimer(UtilTimer* timer){
+    /* 重置后需要调整定时器在时间轮中的位置 */
+    _utils._timerList.adjustTimer(timer, 3*TIME_SLOT);
+
+    LOG_INFO("%s","reset timer once");
+}
+
+/*
+*  功能：线程池或数据库通道过载时暂停接受新连接，让新连接留在内核的队列中，而不是接受后无法处理；
+*       排队的请求降到低水位以下后恢复。只有拥有监听socket的循环需要检查
+*/
+void EventLoop::checkAccept(){
+    if(_listenFd == -1){
+        return;
+    }
+    ThreadPool<HttpConn>* dbPool = _server->_dbPool;
+    bool poolOverloaded = _server->_threadsPool->overloaded();
+    bool laneOverloaded = (dbPool != NULL && dbPool->overloaded());
+    bool overloaded = poolOverloaded || laneOverloaded;
+    if(overloaded == _acceptPaused){
+        return;
+    }
+    _acceptPaused = overloaded;
+    if(_acceptPaused){
+        if(laneOverloaded){
+            LOG_WARN("database lane is overloaded, stop accepting, %ld requests dropped",
+                dbPool->dropNum());
+        }
+        else{
+            LOG_WARN("thread pool is overloaded, stop accepting, %ld requests dropped",
+                _server->_threadsPool->dropNum());
+        }
+        if(_ring){
+            uringSetAccept(false);
+        }
+        else{
+            epoll_ctl(_epollFd, EPOLL_CTL_DEL, _listenFd, 0);
+        }
+    }
+    else{
+        LOG_INFO("%s", "thread pool recovers, resume accepting");
+        if(_ring){
+            uringSetAccept(true);
+        }
+        else{
+            _utils.addFd(_epollFd, _listenFd, false, _server->_listenTrigMode);
+        }
+    }
+}
+
+/*
+*  功能：请求队列已满，拒绝连接上的请求并关闭连接
+*  参数：
+*       --conn: 客户连接
+*       --busy: 是否先发送503响应，响应已经发送了一部分时为false
+*/
+void EventLoop::rejectConn(Conn* conn, bool busy){
+    /* 连接没有交给工作线程 */
+    conn->_client._busy = false;
+    if(busy){
+        conn->_http.sendBusy();
+    }
+    if(_ring){
+        uringCloseConn(conn);
+    }
+    else{
+        dealTimer(conn);
+    }
+}
+
+/*
+*  功能：将连接上已解析的注册请求交给异步数据库客户端，排队的查询过多则返回503并关闭连接
+*  参数：
+*       --conn: 客户连接
+*       --sockFd: 客户连接的socket
+*/
+void EventLoop::startSql(Conn* conn, int sockFd){
+    SqlQuery query;
+    query._sockFd = sockFd;
+    query._gen = conn->_gen;
+    conn->_http.getUser(query._name, query._password);
+    if(!_asyncSql->submit(query)){
+        rejectConn(conn, true);
+        return;
+    }
+    dealWithSql();
+}
+
+/*
+*  功能：监听需要等待的数据库连接，将完成查询的请求交给线程池生成响应
+*/
+void EventLoop::dealWithSql(){
+    int fd, events;
+    while(_asyncSql->nextWatch(fd, events)){
+        if(_ring){
+            uringWatchSql(fd, events);
+        }
+        else{
+            /* 数据库连接的代数为0，和客户连接区分；EPOLLONESHOT, 每次等待重新监听 */
+            epoll_event event;
+            event.data.u64 = (uint32_t)fd;
+            event.events = events | EPOLLONESHOT;
+            if(epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event) == -1 && errno == ENOENT){
+                epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event);
+            }
+        }
+    }
+
+    SqlQuery query;
+    int result;
+    while(_asyncSql->popDone(query, result)){
+        /* 和同步插入一样，插入成功才加入用户表 */
+        if(0 == result){
+            HttpConn::addUser(query._name, query._password);
+        }
+        Conn* conn = _conns->find(query._sockFd);
+        if(conn == NULL || conn->_gen != query._gen || !releaseConn(conn)){
+            /* 查询期间连接已经超时，现在关闭 */
+            continue;
+        }
+        conn->_http.setSqlResult(result);
+        if(!_server->_threadsPool->append(&conn->_http, 2)){
+            rejectConn(conn, true);
+            continue;
+        }
+        conn->_client._busy = true;
+    }
+}
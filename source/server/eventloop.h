@@ -0,0 +1,182 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-2
+@Detail    : 事件循环类，每个事件循环拥有独立的epoll、监听socket和定时器
+@Reference : https://github.com/qinguoyi/TinyWebServer
+*/
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <cassert>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <vector>
+#include "../http/httpconn.h"
+#include "../timer/twTimer.h"
+#include "utils.h"
+#include "../log/log.h"
+#include "../locker/lockfreequeue.h"
+#include "../uring/iouring.h"
+#include "../mysql/asyncsql.h"
+#include "connregistry.h"
+
+/* 监听事件数量的最大值 */
+const int MAX_EVENT_NUMBER = 10000;
+/* 超时单位，单位ms，连接空闲3个超时单位后关闭 */
+const int TIME_SLOT = 5000;
+/* 一次读取signalfd的信号数量的最大值 */
+const int MAX_SIGNAL_INFO = 8;
+/* 主循环交给从循环、尚未处理的连接数量的最大值，必须是2的幂 */
+const int MAX_PENDING_CONN = 4096;
+/* 工作线程交回事件循环、尚未处理的连接事件数量的最大值，必须是2的幂 */
+const int MAX_CONN_EVENT = 16384;
+/* 线程池过载、暂停接受新连接期间，检查是否可以恢复的间隔，单位ms */
+const int ACCEPT_PAUSE_CHECK = 10;
+/* io_uring提交队列的长度 */
+const int URING_ENTRIES = 4096;
+/* io_uring接收缓冲区的个数和大小 */
+const int URING_BUF_NUM = 1024;
+const int URING_BUF_SIZE = 2048;
+/* 每个事件循环等待空闲异步数据库连接的查询数量的最大值，超过则返回503 */
+const int MAX_SQL_WAIT = 1024;
+/* 工作线程交回的连接事件：请求需要事件循环异步执行数据库查询 */
+const int CONN_EVENT_SQL = -1;
+
+class WebServer;
+
+/* 主循环接受后交给从循环的新连接 */
+struct PendingConn{
+    int _sockFd;             /* 连接fd */
+    sockaddr_in _address;    /* 客户地址 */
+};
+
+/* 工作线程处理完请求后交回事件循环的连接事件 */
+struct ConnEvent{
+    int _sockFd;             /* 连接fd */
+    unsigned _gen;           /* 连接的代数 */
+    int _event;              /* 连接接下来等待的事件，EPOLLIN或EPOLLOUT；0表示处理失败，需要关闭连接；
+                                CONN_EVENT_SQL表示需要异步查询 */
+};
+
+/* 事件循环类：一个线程运行一个事件循环。有两种分发新连接的方式：
+   -- SO_REUSEPORT: 多个事件循环各自创建监听socket，由内核将新连接分散到各个循环中；
+   -- 主从Reactor: 0号主循环只负责accept，将新连接轮流放入各个从循环的无锁队列，
+      再通过eventfd唤醒从循环，从循环初始化连接并处理其上的I/O。
+   每个循环只处理属于自己的连接，独占这些连接对应的HttpConn和定时器。
+   定时器由每个循环自己的timerfd驱动；信号在所有线程中被屏蔽，由0号循环通过signalfd接收，
+   再经信号管道转发给其他循环，没有信号处理函数打断系统调用。
+   Reactor模式下工作线程完成读写后，将连接接下来等待的事件放入无锁队列并通过eventfd唤醒事件循环，
+   事件循环不等待工作线程，由它重置EPOLLONESHOT或关闭连接。
+   I/O后端可以是epoll，也可以是io_uring：io_uring下每次循环只调用一次io_uring_enter,
+   Proactor模式由multishot accept/recv接收连接和数据，响应通过writev提交项发送；
+   Reactor模式用poll提交项代替EPOLLONESHOT，由工作线程读写。
+   开启异步数据库客户端时，注册请求的插入由事件循环执行：工作线程解析请求后交回连接，
+   查询期间数据库连接的socket和客户连接一起由本循环监听，完成后请求再交给线程池生成响应 */
+class EventLoop{
+public:
+    EventLoop();
+    ~EventLoop();
+
+    void init(WebServer* server, int id);
+    void eventListen();
+    void start();
+    void join();
+    void loop();
+    bool queueConn(int httpFd, const sockaddr_in& addr);
+    void postEvent(int sockFd, unsigned gen, int event);
+    /* 本循环是否有异步数据库客户端 */
+    bool hasAsyncSql(){
+        return _asyncSql != NULL;
+    }
+    /* 调用者是否为运行本循环的线程 */
+    bool inLoop(){
+        return pthread_equal(pthread_self(), _tid) != 0;
+    }
+
+private:
+    static void* worker(void* arg);
+    void createListenFd();
+    bool dealClientData();
+    bool dispatchConn(int httpFd, const sockaddr_in& addr);
+    void dealWithConn();
+    void addPendingConns();
+    void dealWithEvents();
+    void addConn(int httpFd, const sockaddr_in& addr);
+    void setTimer(Conn* conn, int httpFd, struct sockaddr_in addr);
+    void dealTimer(Conn* conn);
+    bool releaseConn(Conn* conn);
+    void dealWithTimer(bool& timeOut);
+    void dealWithSignalFd(bool& stopServer);
+    void dealWithSignalInfo(const signalfd_siginfo* infos, int num, bool& stopServer);
+    void dealWithSignal(bool& stopServer);
+    void dealWithSignals(const char* signals, int num, bool& stopServer);
+    void dealWithRead(Conn* conn);
+    void dealWithWrite(Conn* conn);
+    void adjustTimer(UtilTimer* timer);
+    void checkAccept();
+    void rejectConn(Conn* conn, bool busy);
+    void startSql(Conn* conn, int sockFd);
+    void dealWithSql();
+
+    /* io_uring后端，实现在uringloop.cpp中 */
+    void uringListen();
+    void uringLoop();
+    void uringAddConn(Conn* conn, int httpFd);
+    void uringCloseConn(Conn* conn);
+    void uringDispatch(Conn* conn);
+    void uringFeedPending(Conn* conn);
+    void uringDealWithAccept(int res, unsigned flags);
+    void uringDealWithRecv(uint64_t userData, int res, unsigned flags);
+    void uringRetryRecvs();
+    void uringDealWithWrite(uint64_t userData, int res);
+    void uringDealWithPoll(uint64_t userData, int res);
+    void uringDealWithEvents();
+    void uringSetAccept(bool accept);
+    void uringWatchSql(int fd, int events);
+    Conn* uringAlive(uint64_t userData);
+    Conn* uringFind(uint64_t userData);
+
+public:
+    int _id;            /* 事件循环的编号，0号运行在主线程中 */
+    int _epollFd;       /* epoll监听文件描述符 */
+    int _listenFd;      /* 监听文件描述符 */
+    int _pipeFd[2];     /* 一对管道，0号循环将收到的信号转发给其他循环 */
+    int _timerFd;       /* timerfd, 驱动本循环的时间轮 */
+    int _signalFd;      /* signalfd, 只有0号循环创建，其他循环为-1 */
+    int _wakeFd;        /* eventfd, 主循环交来新连接时唤醒从循环 */
+    int _eventFd;       /* eventfd, 工作线程交回连接事件时唤醒本循环 */
+    pthread_t _thread;  /* 运行该事件循环的线程 */
+    pthread_t _tid;     /* 实际运行本循环的线程，0号循环为主线程 */
+
+private:
+    WebServer* _server;        /* 所属的服务器，提供配置和线程池 */
+    ConnRegistry* _conns;      /* 连接表，按fd索引，本循环只访问自己接受的连接 */
+    int _closeLog;             /* 关闭日志功能 */
+    epoll_event _events[MAX_EVENT_NUMBER];  /* 监听事件数组 */
+    Utils _utils;              /* 工具类，拥有本循环的定时器 */
+    LockFreeQueue<PendingConn>* _pendingConns;  /* 主循环交来的新连接 */
+    int _nextLoop;             /* 主循环下一次分发新连接的从循环编号 */
+    bool _acceptPaused;        /* 线程池过载，暂停接受新连接 */
+
+    IoUring* _ring;            /* io_uring实例，epoll后端为NULL */
+    vector<uint64_t> _starvedRecvs;  /* 因为没有空闲缓冲区而结束、等待重新提交的recv */
+    bool _bufRecycled;         /* 本次循环是否有缓冲区放回环中 */
+    LockFreeQueue<ConnEvent>* _connEvents;  /* 工作线程交回的连接事件 */
+    AsyncSql* _asyncSql;       /* 异步数据库客户端，未开启时为NULL */
+    char _signals[1024];       /* 读取信号管道的缓冲区 */
+    signalfd_siginfo _sigInfos[MAX_SIGNAL_INFO];  /* 读取signalfd的缓冲区 */
+    uint64_t _timerTicks;      /* 读取_timerFd的缓冲区，到期次数 */
+    uint64_t _wakeCount;       /* 读取_wakeFd的缓冲区 */
+    uint64_t _eventCount;      /* 读取_eventFd的缓冲区 */
+};
+
+#endif
@@ -0,0 +1,511 @@
+#include "eventloop.h"
+#include "webserver.h"
+
+/* io_uring完成项的类型，放在user_data的高8位 */
+enum URING_TYPE{
+    URING_ACCEPT = 1, URING_RECV, URING_WRITE, URING_POLL, URING_SIGNAL, URING_WAKE, URING_EVENT,
+    URING_TIMER, URING_SIGNALFD, URING_CANCEL, URING_SQL
+};
+
+/*
+*  功能：组合完成项的user_data: 类型(8位) + 连接的代数(24位) + fd(32位)
+*/
+static uint64_t uringData(int type, unsigned gen, int fd){
+    return ((uint64_t)type << 56) | ((uint64_t)(gen & 0xffffff) << 32) | (uint32_t)fd;
+}
+
+/*
+*  功能：创建io_uring实例，Proactor模式下向内核注册接收缓冲区环
+*/
+void EventLoop::uringListen(){
+    _ring = new IoUring();
+    if(!_ring->init(URING_ENTRIES)){
+        LOG_ERROR("%s", "io_uring init failed");
+        exit(1);
+    }
+    if(0 == _server->_actorMode && !_ring->setupBufs(0, URING_BUF_NUM, URING_BUF_SIZE)){
+        LOG_ERROR("%s", "io_uring buffer ring registration failed");
+        exit(1);
+    }
+}
+
+/*
+*  功能：io_uring后端的事件循环，每次循环一次io_uring_enter提交所有请求并等待完成项
+*/
+void EventLoop::uringLoop(){
+    bool timeOut = false;     /* 是否超时 */
+    bool stopServer = false;  /* 是否停止服务 */
+
+    if(_listenFd != -1){
+        _ring->prepAccept(_listenFd, uringData(URING_ACCEPT, 0, _listenFd));
+    }
+    _ring->prepRead(_pipeFd[0], _signals, sizeof(_signals), uringData(URING_SIGNAL, 0, _pipeFd[0]));
+    _ring->prepRead(_timerFd, &_timerTicks, sizeof(_timerTicks), uringData(URING_TIMER, 0, _timerFd));
+    if(_signalFd != -1){
+        _ring->prepRead(_signalFd, _sigInfos, sizeof(_sigInfos), uringData(URING_SIGNALFD, 0, _signalFd));
+    }
+    if(_wakeFd != -1){
+        _ring->prepRead(_wakeFd, &_wakeCount, sizeof(_wakeCount), uringData(URING_WAKE, 0, _wakeFd));
+    }
+    _ring->prepRead(_eventFd, &_eventCount, sizeof(_eventCount), uringData(URING_EVENT, 0, _eventFd));
+
+    while(!stopServer){
+        /* 提交请求，等待完成项。暂停接受新连接期间定时醒来，检查是否可以恢复 */
+        int ret = _ring->submitAndWait(1, _acceptPaused ? ACCEPT_PAUSE_CHECK : -1);
+        if(ret < 0 && ret != -EINTR && ret != -ETIME){
+            LOG_ERROR("%s", "io_uring failure");
+            break;
+        }
+        /* 线程池过载时暂停接受新连接，恢复后继续 */
+        checkAccept();
+        /* 处理所有完成项 */
+        io_uring_cqe* cqe;
+        while((cqe = _ring->peekCqe()) != NULL){
+            uint64_t userData = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            _ring->seenCqe();
+
+            int sockFd = (int)(userData & 0xffffffff);
+            switch(userData >> 56){
+                case URING_ACCEPT:
+                {
+                    /* 有新的连接 */
+                    uringDealWithAccept(res, flags);
+                    break;
+                }
+                case URING_RECV:
+                {
+                    /* 客户连接上发来新的数据 */
+                    uringDealWithRecv(userData, res, flags);
+                    break;
+                }
+                case URING_WRITE:
+                {
+                    /* 响应发送了一部分 */
+                    uringDealWithWrite(userData, res);
+                    break;
+                }
+                case URING_POLL:
+                {
+                    /* Reactor模式，连接可读或可写 */
+                    uringDealWithPoll(userData, res);
+                    break;
+                }
+                case URING_TIMER:
+                {
+                    /* 时间片到期 */
+                    if(res == sizeof(_timerTicks)){
+                        timeOut = true;
+                    }
+                    _ring->prepRead(_timerFd, &_timerTicks, sizeof(_timerTicks), userData);
+                    break;
+                }
+                case URING_SIGNALFD:
+                {
+                    /* 处理信号 */
+                    if(res > 0){
+                        dealWithSignalInfo(_sigInfos, res / sizeof(signalfd_siginfo), stopServer);
+                    }
+                    _ring->prepRead(_signalFd, _sigInfos, sizeof(_sigInfos), userData);
+                    break;
+                }
+                case URING_SIGNAL:
+                {
+                    /* 处理0号循环转发的信号 */
+                    if(res > 0){
+                        dealWithSignals(_signals, res, stopServer);
+                    }
+                    _ring->prepRead(_pipeFd[0], _signals, sizeof(_signals), userData);
+                    break;
+                }
+                case URING_WAKE:
+                {
+                    /* 主循环交来了新的连接 */
+                    addPendingConns();
+                    _ring->prepRead(_wakeFd, &_wakeCount, sizeof(_wakeCount), userData);
+                    break;
+                }
+                case URING_CANCEL:
+                {
+                    /* 取消accept的结果，不需要处理 */
+                    break;
+                }
+                case URING_SQL:
+                {
+                    /* 数据库连接就绪，继续执行查询 */
+                    if(res > 0 && _asyncSql->resume(sockFd, res)){
+                        dealWithSql();
+                    }
+                    break;
+                }
+                case URING_EVENT:
+                {
+                    /* 工作线程交回了连接事件 */
+                    uringDealWithEvents();
+                    _ring->prepRead(_eventFd, &_eventCount, sizeof(_eventCount), userData);
+                    break;
+                }
+                default:
+                    LOG_ERROR("unknown io_uring completion on fd %d", sockFd);
+                    break;
+            }
+        }
+        uringRetryRecvs();
+        /* 超时 */
+        if(timeOut){
+            _utils.timerHandler(_timerTicks);
+            if(0 == _id){
+                /* 会话的时间轮由0号循环驱动 */
+                SessionTable::getInstance()->tick(_timerTicks);
+            }
+            if(_asyncSql){
+                /* 取回维护线程重连好的数据库连接 */
+                _asyncSql->tick();
+                dealWithSql();
+            }
+            timeOut = false;
+        }
+    }
+}
+
+/*
+*  功能：完成项所属的连接是否仍然存在。连接关闭后定时器被置空，fd被重用后代数不同
+*  参数：
+*       --userData: 完成项的user_data
+*  返回值：连接仍然存在则返回连接，否则返回NULL
+*/
+Conn* EventLoop::uringAlive(uint64_t userData){
+    Conn* conn = uringFind(userData);
+    if(conn == NULL || conn->_client._timer == NULL){
+        return NULL;
+    }
+    return conn;
+}
+
+/*
+*  功能：完成项所属的连接，fd被重用后代数不同则返回NULL。连接可能已经关闭或到期
+*  参数：
+*       --userData: 完成项的user_data
+*/
+Conn* EventLoop::uringFind(uint64_t userData){
+    int sockFd = (int)(userData & 0xffffffff);
+    unsigned gen = (userData >> 32) & 0xffffff;
+    Conn* conn = _conns->find(sockFd);
+    if(conn == NULL || (conn->_gen & 0xffffff) != gen){
+        return NULL;
+    }
+    return conn;
+}
+
+/*
+*  功能：新连接初始化后，Proactor模式提交multishot recv, Reactor模式提交poll
+*  参数：
+*       --conn: 客户连接
+*       --httpFd: 客户连接的socket
+*/
+void EventLoop::uringAddConn(Conn* conn, int httpFd){
+    conn->_pending.clear();
+    if(1 == _server->_actorMode){
+        _ring->prepPoll(httpFd, EPOLLIN | EPOLLRDHUP, uringData(URING_POLL, conn->_gen, httpFd));
+    }
+    else{
+        _ring->prepRecv(httpFd, uringData(URING_RECV, conn->_gen, httpFd));
+    }
+}
+
+/*
+*  功能：关闭连接，删除定时器。之后该连接上的完成项都会被忽略
+*  参数：
+*       --conn: 客户连接
+*/
+void EventLoop::uringCloseConn(Conn* conn){
+    conn->_client._busy = false;
+    conn->_client._closing = false;
+    conn->_pending.clear();
+    dealTimer(conn);
+}
+
+/*
+*  功能：Proactor模式，数据已放入读缓冲区，将请求交给线程池处理
+*  参数：
+*       --conn: 客户连接
+*/
+void EventLoop::uringDispatch(Conn* conn){
+    conn->_client._busy = true;
+    LOG_INFO("deal with the client(%s)",
+       inet_ntoa(conn->_http.getAddress()->sin_addr));
+    /* 放入请求队列，队列已满则返回503并关闭连接 */
+    if(!_server->_threadsPool->appendP(&conn->_http)){
+        rejectConn(conn, true);
+        return;
+    }
+    /* 有数据传输，则连接重置活跃监测时间 */
+    adjustTimer(conn->_client._timer);
+}
+
+/*
+*  功能：上一个请求处理完毕，将处理期间收到的数据交给连接
+*  参数：
+*       --conn: 客户连接
+*/
+void EventLoop::uringFeedPending(Conn* conn){
+    if(conn->_client._closing){
+        uringCloseConn(conn);
+        return;
+    }
+    if(conn->_pending.empty()){
+        return;
+    }
+    int len = conn->_pending.size();
+    if(conn->_http.readFrom(conn->_pending.data(), len) < len){
+        /* 读缓冲区已满 */
+        uringCloseConn(conn);
+        return;
+    }
+    conn->_pending.clear();
+    uringDispatch(conn);
+}
+
+/*
+*  功能：处理multishot accept的完成项
+*  参数：
+*       --res: 新连接的fd, 失败为-errno
+*       --flags: 完成项标志
+*/
+void EventLoop::uringDealWithAccept(int res, unsigned flags){
+    if(!(flags & IORING_CQE_F_MORE) && res != -ECANCELED){
+        /* multishot请求结束了，重新提交。被取消的是暂停接受，恢复时再提交 */
+        _ring->prepAccept(_listenFd, uringData(URING_ACCEPT, 0, _listenFd));
+    }
+    if(res < 0){
+        LOG_ERROR("%s, errno is %d", "accept error", -res);
+        return;
+    }
+    int httpFd = res;
+    if(HttpConn::_userCount >= _conns->maxConn()){
+        _utils.showError(httpFd, "Interval server is busy");
+        LOG_ERROR("%s", "Interval server is busy");
+        return;
+    }
+    struct sockaddr_in clientAddr;
+    socklen_t clientAddrLen = sizeof(clientAddr);
+    getpeername(httpFd, (struct sockaddr*)&clientAddr, &clientAddrLen);
+    /* 初始化客户端连接，或交给从循环 */
+    dispatchConn(httpFd, clientAddr);
+}
+
+/*
+*  功能：处理multishot recv的完成项，将数据从内核选取的缓冲区复制到连接的读缓冲区
+*  参数：
+*       --userData: 完成项的user_data
+*       --res: 接收的字节数，0表示对方关闭，失败为-errno
+*       --flags: 完成项标志，包含缓冲区编号
+*/
+void EventLoop::uringDealWithRecv(uint64_t userData, int res, unsigned flags){
+    int sockFd = (int)(userData & 0xffffffff);
+    Conn* conn = uringAlive(userData);
+    bool dispatch = false;
+    bool overflow = false;
+
+    if(flags & IORING_CQE_F_BUFFER){
+        int bufId = flags >> IORING_CQE_BUFFER_SHIFT;
+        if(conn && res > 0 && !conn->_client._closing){
+            char* buf = _ring->getBuf(bufId);
+            if(conn->_client._busy){
+                /* 上一个请求还在处理，先保存起来，最多保存一个读缓冲区的数据 */
+                if(conn->_pending.size() + res > (size_t)HttpConn::READ_BUFFER_SIZE){
+                    overflow = true;
+                }
+                else{
+                    conn->_pending.append(buf, res);
+                }
+            }
+            else if(conn->_http.readFrom(buf, res) < res){
+                overflow = true;
+            }
+            else{
+                dispatch = true;
+            }
+        }
+        /* 数据已取走，缓冲区放回环中 */
+        _ring->recycleBuf(bufId);
+        _bufRecycled = true;
+    }
+    if(!conn || conn->_client._closing){
+        /* 连接已经关闭，或者处理结束后关闭，丢弃之后收到的数据 */
+        return;
+    }
+    if(overflow || res == 0 || (res < 0 && res != -ENOBUFS)){
+        /* 读缓冲区已满、对方关闭连接或者接收出错 */
+        if(conn->_client._busy){
+            conn->_client._closing = true;
+            if(flags & IORING_CQE_F_MORE){
+                /* 不再接收，取消multishot recv */
+                _ring->prepCancel(userData, uringData(URING_CANCEL, 0, sockFd));
+            }
+        }
+        else{
+            uringCloseConn(conn);
+        }
+        return;
+    }
+    if(!(flags & IORING_CQE_F_MORE)){
+        if(res == -ENOBUFS){
+            /* 缓冲区都在使用中，立即重新提交只会再次得到ENOBUFS，等有缓冲区放回后再提交 */
+            _starvedRecvs.push_back(userData);
+        }
+        else{
+            /* multishot请求结束了，重新提交 */
+            _ring->prepRecv(sockFd, userData);
+        }
+    }
+    if(dispatch){
+        uringDispatch(conn);
+    }
+}
+
+/*
+*  功能：有缓冲区放回环中后，重新提交因为没有缓冲区而结束的multishot recv
+*/
+void EventLoop::uringRetryRecvs(){
+    if(!_bufRecycled){
+        return;
+    }
+    _bufRecycled = false;
+    for(size_t i=0; i<_starvedRecvs.size(); ++i){
+        Conn* conn = uringAlive(_starvedRecvs[i]);
+        if(conn && !conn->_client._closing){
+            _ring->prepRecv(conn->_client._sockFd, _starvedRecvs[i]);
+        }
+    }
+    _starvedRecvs.clear();
+}
+
+/*
+*  功能：处理writev的完成项，没有发送完则继续提交
+*  参数：
+*       --userData: 完成项的user_data
+*       --res: 发送的字节数，失败为-errno
+*/
+void EventLoop::uringDealWithWrite(uint64_t userData, int res){
+    int sockFd = (int)(userData & 0xffffffff);
+    Conn* conn = uringFind(userData);
+    if(!conn){
+        return;
+    }
+    HttpConn* http = &conn->_http;
+    if(conn->_client._timer == NULL){
+        /* 发送期间定时器到期，socket已经shutdown，发送结束，现在关闭 */
+        if(conn->_client._busy){
+            http->finishResponse();
+            releaseConn(conn);
+        }
+        return;
+    }
+    if(res < 0){
+        /* 发送失败，关闭连接 */
+        http->finishResponse();
+        uringCloseConn(conn);
+        return;
+    }
+    if(!http->sent(res)){
+        /* 没有发送完，继续发送 */
+        _ring->prepWritev(sockFd, http->getIv(), http->getIvCount(), userData);
+        return;
+    }
+    LOG_INFO("send data to the client(%s)", inet_ntoa(http->getAddress()->sin_addr));
+    if(http->finishResponse()){
+        /* 保持连接，处理期间收到的数据 */
+        conn->_client._busy = false;
+        uringFeedPending(conn);
+    }
+    else{
+        uringCloseConn(conn);
+    }
+}
+
+/*
+*  功能：Reactor模式，处理poll的完成项，和epoll后端一样交给工作线程读写
+*  参数：
+*       --userData: 完成项的user_data
+*       --res: 发生的事件，失败为-errno
+*/
+void EventLoop::uringDealWithPoll(uint64_t userData, int res){
+    Conn* conn = uringAlive(userData);
+    if(!conn){
+        return;
+    }
+    if(res < 0 || (res & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        /* 客户端关闭连接 */
+        uringCloseConn(conn);
+    }
+    else if(res & EPOLLIN){
+        dealWithRead(conn);
+    }
+    else if(res & EPOLLOUT){
+        dealWithWrite(conn);
+    }
+}
+
+/*
+*  功能：取出工作线程交回的连接事件，提交相应的请求
+*/
+void EventLoop::uringDealWithEvents(){
+    ConnEvent connEvent;
+    while(_connEvents->pop(connEvent)){
+        int sockFd = connEvent._sockFd;
+        Conn* conn = _conns->find(sockFd);
+        if(conn->_gen != connEvent._gen || !releaseConn(conn)){
+            /* 处理期间连接已经超时，现在关闭 */
+            continue;
+        }
+        if(0 == connEvent._event){
+            /* 处理失败，关闭连接 */
+            uringCloseConn(conn);
+        }
+        else if(CONN_EVENT_SQL == connEvent._event){
+            /* 异步执行数据库查询，完成前连接仍处于处理中 */
+            conn->_client._busy = true;
+            startSql(conn, sockFd);
+        }
+        else if(1 == _server->_actorMode){
+            /* Reactor: 相当于重置EPOLLONESHOT */
+            _ring->prepPoll(sockFd, connEvent._event | EPOLLRDHUP, uringData(URING_POLL, conn->_gen, sockFd));
+        }
+        else if(connEvent._event == EPOLLOUT){
+            /* Proactor: 响应报文已准备好，提交writev，发送完成前连接仍处于处理中 */
+            conn->_client._busy = true;
+            HttpConn* http = &conn->_http;
+            _ring->prepWritev(sockFd, http->getIv(), http->getIvCount(), uringData(URING_WRITE, conn->_gen, sockFd));
+        }
+        else{
+            /* Proactor: 请求不完整，继续接收 */
+            uringFeedPending(conn);
+        }
+    }
+}
+
+/*
+*  功能：暂停或恢复接受新连接。暂停时取消multishot accept，恢复时重新提交
+*  参数：
+*       --accept: true: 恢复; false: 暂停
+*/
+void EventLoop::uringSetAccept(bool accept){
+    if(accept){
+        _ring->prepAccept(_listenFd, uringData(URING_ACCEPT, 0, _listenFd));
+    }
+    else{
+        _ring->prepCancel(uringData(URING_ACCEPT, 0, _listenFd), uringData(URING_CANCEL, 0, _listenFd));
+    }
+}
+
+/*
+*  功能：监听数据库连接的socket，相当于EPOLLONESHOT
+*  参数：
+*       --fd: 数据库连接的socket
+*       --events: 需要监听的事件
+*/
+void EventLoop::uringWatchSql(int fd, int events){
+    _ring->prepPoll(fd, events, uringData(URING_SQL, 0, fd));
+}
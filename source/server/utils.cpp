@@ -1,8 +1,5 @@
 #include "utils.h"
 
-int Utils::_epollFd = 0;
-int* Utils::_pipeFd = NULL;
-
 void Utils::init(int timeSlot){
    _timeSlot = timeSlot;
 }
@@ -17,7 +14,7 @@ void Utils::init(int timeSlot){
 */
 void Utils::addFd(int epollFd,int fd, bool oneShot, int trigMode){
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = (uint32_t)fd;
 
     /* epoll默认是LT模式
        EPOLLIN: 对应文件可以读；
@@ -66,19 +63,6 @@ void Utils::addSig(int sig, void(handler)(int), bool restart){
    assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-/*
-*  功能：信号处理函数, 发送信号
-*  参数：
-*        --sig: 信号
-*/
-void Utils::sigHandler(int sig){
-   int oldErrno = errno;
-   int msg = sig;
-   /* 发送信号 */
-   send(_pipeFd[1], (char*)&msg, 1, 0);
-   errno = oldErrno;
-}
-
 /*
 *  功能：向fd发送错误信息
 *  参数：
@@ -91,9 +75,12 @@ void Utils::showError(int fd, const char* info){
 }
 
 /*
-*  功能：SIGALRM的信号处理函数，执行tick函数，并重新定时
+*  功能：timerfd到期，执行tick函数。事件循环繁忙时可能错过了几次，补上
+*  参数：
+*        --ticks: timerfd到期的次数
 */
-void Utils::timerHandler(){
-   _timerList.tick();
-   alarm(_timeSlot);
+void Utils::timerHandler(uint64_t ticks){
+   for(uint64_t i=0; i<ticks; i++){
+      _timerList.tick();
+   }
 }
@@ -17,11 +17,15 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <stdint.h>
 #include <cassert>
 #include "../log/log.h"
 #include "../http/httpconn.h"
 #include "../timer/twTimer.h"
 
+/* 事件循环数量的最大值 */
+const int MAX_LOOP_NUM = 64;
+
 /* 工具类, 可以优化 */
 class Utils{
 public:
@@ -32,14 +36,11 @@ public:
     void addFd(int epollFd,int fd, bool oneShot, int trigMode);
     int setNonblocking(int fd);
     void addSig(int sig, void(handler)(int), bool restart = false);
-    static void sigHandler(int sig);
     void showError(int fd, const char* info);
-    void timerHandler();
+    void timerHandler(uint64_t ticks);
 
 public:
-    static int* _pipeFd;   /* webserver中的_pipeFd */
-    static int _epollFd;   /* webserver中的_epollFd */
-    int _timeSlot;         /* 时间片，定时时间 */
+    int _timeSlot;         /* 时间片，时间轮转动一次的时间，单位ms */
     SortTimerWheel _timerList;  /* 定时器链表 */
 };
 
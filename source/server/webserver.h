@@ -20,16 +20,12 @@
 #include "../http/httpconn.h"
 #include "../timer/twTimer.h"
 #include "utils.h"
+#include "eventloop.h"
+#include "connregistry.h"
 #include "../log/log.h"
 #include "../mysql/sqlpool.h"
 using namespace std;
 
-/* 文件描述符数量的最大值 */
-const int MAX_FD = 10240;
-/* 监听事件数量的最大值 */
-const int MAX_EVENT_NUMBER = 10000;
-/* 超时单位 */
-const int TIME_SLOT = 5;
 
 class WebServer{
 public:
@@ -45,41 +41,45 @@ public:
     void eventListen();
     void eventLoop();
 
-    bool dealClientData();
-    void setTimer(int httpFd, struct sockaddr_in addr);
-    void dealTimer(UtilTimer* timer, int sockFd);
-    void dealWithSignal(bool& timeOut, bool& stopServer);
-    void dealWithRead(int sockFd);
-    void dealWithWrite(int sockFd);
-    void adjustTimer(UtilTimer* timer);
 public:
     int _port;          /* 端口号 */
     char* _root;        /* 文件路径，根目录 */
     int _writeLog;      /* 日志写入方式，默认同步 */
     int _closeLog;      /* 关闭日志功能，默认不关闭 */
     int _actorMode;     /* 事件处理模式，默认是Proactor */
-    int _pipeFd[2];     /* 一对管道，用于信号通信 */
-    int _epollFd;       /* epoll监听文件描述符 */
-    HttpConn* _usersHttp;  /* http连接数组 */
+    ConnRegistry* _conns;  /* 连接表，按fd索引 */
 
     SqlPool* _sqlPool;   /* 数据库连接池 */
     string _user;       /* 登录数据库的用户名 */
     string _password;   /* 密码 */
     string _database;   /* 数据库名 */
     int _sqlNum;        /* 数据库连接池数量 */
+    int _sqlMinNum;     /* 开始服务前必须建立的数据库连接数量，其余在后台建立 */
+    string _sqlHost;    /* 主库地址，可以带端口，如"127.0.0.1:3306" */
+    string _replicaHosts;  /* 只读副本的地址，多个以逗号分隔，空表示不做读写分离 */
+    int _sqlPin;        /* 每个工作线程独占一个数据库连接，连接池只作补充，0:否; 1:是 */
+    int _asyncSqlNum;   /* 每个事件循环的异步数据库连接数量，0:不使用异步查询 */
+    int _batchRows;     /* 注册用户批量插入时每批的最大行数，0:每个请求单独插入 */
+    string _snapshot;   /* 用户表快照文件，启动时加载、退出时保存，空:不使用快照 */
 
     ThreadPool<HttpConn>* _threadsPool;  /* 线程池 */
-    int _threadNum;      /* 线程池中线程数量 */
+    ThreadPool<HttpConn>* _dbPool;       /* 数据库通道的线程池，处理登录注册请求 */
+    int _dbThreadNum;    /* 数据库通道的线程数量，0:不区分通道 */
+    int _threadNum;      /* 线程池中线程数量，弹性伸缩时为下限 */
+    int _maxThreadNum;   /* 线程池中线程数量的上限，不大于_threadNum时不伸缩 */
 
-    epoll_event _events[MAX_EVENT_NUMBER];  /* 监听事件数组 */
+    EventLoop* _loops;   /* 事件循环数组，每个循环运行在一个线程中 */
+    int _loopNum;        /* 事件循环数量，默认1个 */
+    int _dispatchMode;   /* 新连接分发方式，0:SO_REUSEPORT; 1:主从Reactor */
+    int _ioMode;         /* I/O后端，0:epoll; 1:io_uring */
+    int _runToCompletion; /* Reactor模式下工作线程处理完请求后直接发送响应，0:否; 1:是 */
+    int _schedMode;      /* 线程池调度方式，0:共享请求队列; 1:每个线程一个队列，空闲时窃取 */
 
-    int _listenFd;        /* 监听文件描述符 */
     int _optLinger;       /* 是否优雅关闭链接 */
     int _trigMode;        /* 触发组合模式，默认0:listenFd(LT)+httpFd(LT) */
     int _listenTrigMode;  /* listenFd触发模式,0:LT;1:ET */
     int _httpTrigMode;    /* http请求触发模式,0:LT;1:ET */
 
-    ClientData* _usersTimer;
     Utils _utils;
 };
 
@@ -8,64 +8,319 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
 #include <exception>
+#include <atomic>
+#include <stdint.h>
 #include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/epoll.h>
 #include "../locker/locker.h"
+#include "../locker/lockfreequeue.h"
 #include "../mysql/sqlpool.h"
 
-/* 线程池类，功能：创建若干工作线程，不释放，存放在线程数组中；
-   可以通过函数向请求队列添加请求，无请求，工作线程阻塞；有请求，解除阻塞，有信号量进行通知 */
+/* 线程池类，功能：创建若干工作线程(分离)；
+   可以通过函数向请求队列(无锁环形队列)添加请求，队列为空时工作线程在事件计数上休眠，有请求时被唤醒。
+   通道: 可以为线程池设置一个数据库通道(另一个线程池，有自己的线程和队列)，登录注册等请求在数据库通道处理，
+   静态资源请求不会排在它们后面，也不会占用数据库连接。
+   调度模式0: 所有工作线程共享一个请求队列；
+   调度模式1: 每个工作线程一个请求队列，同一连接的请求总是进入同一队列，空闲的工作线程从其他队列窃取。
+   弹性伸缩: 线程数在[threadNum, maxThreadNum]之间。取出的请求排队时间过长且没有空闲线程时增加一个线程，
+   线程空闲超过IDLE_TIMEOUT后退出。
+   析构时通知所有工作线程退出，等它们处理完手上的请求、离开请求队列后才释放队列 */
 template<typename T>
 class ThreadPool{
 public:
-    ThreadPool(int actorMode, SqlPool* sqlPool, int threadNum = 8, int maxRequests = 10000);
+    ThreadPool(int actorMode, int runToCompletion, SqlPool* sqlPool, int threadNum = 8, int maxRequests = 10000,
+        int schedMode = 0, int maxThreadNum = 0);
     ~ThreadPool();
     bool append(T* request, int state);
     bool appendP(T* request);
+    /* 设置数据库通道：需要访问数据库的请求解析后交给lane处理 */
+    void setDbLane(ThreadPool* lane){
+        _dbLane = lane;
+    }
+    bool overloaded();
+    /* 因请求队列已满而被拒绝的请求数 */
+    long dropNum(){
+        return _dropNum.load(memory_order_relaxed);
+    }
 
 private:
+    /* 队列中的请求和入队时间 */
+    struct Task{
+        T* _request;
+        int64_t _enqueueTime;  /* 单位us */
+    };
+    static const int64_t MAX_QUEUE_WAIT = 5000;   /* 请求排队超过该时间(us)则考虑增加线程 */
+    static const int64_t GROW_INTERVAL = 2000;    /* 两次增加线程的最小间隔(us) */
+    static const int IDLE_TIMEOUT = 30;           /* 多余的线程空闲超过该时间(s)后退出 */
+    static const int SPIN_BEFORE_WAIT = 16;       /* 队列为空时先让出CPU重试的次数，之后才在futex上休眠 */
+
     static void* worker(void* arg);
+    static int64_t now();
+    bool addWorker();
+    void grow(int64_t waitTime, int64_t current);
     void run();
+    void serve(T* request);
+    bool push(T* request);
+    T* pop(int id);
+    bool tryPop(int id, Task& task);
 
-    int _threadNum;            /* 线程池中线程的数量 */
+    int _threadNum;            /* 线程池中线程数量的下限 */
+    int _maxThreadNum;         /* 线程池中线程数量的上限 */
+    atomic<int> _liveNum;      /* 当前线程数量 */
+    atomic<int64_t> _lastGrow; /* 上次增加线程的时间(us) */
     int _maxRequests;          /* 请求队列所允许的最大请求数 */
-    pthread_t* _threads;       /* 线程池数组 */
-    std::list<T*> _workQueue;  /* 请求队列，未处理的请求集合 */
-    Locker _locker;            /* 互斥锁，操作请求队列时上锁 */
-    Sem _unsettledNum;         /* 是否有请求需要处理，未处理的请求数目 */
-    SqlPool* _sqlPool;         /* 数据库 */
+    int _lowWater;             /* 过载后，排队的请求数降到该值以下才解除过载 */
+    atomic<bool> _overloaded;  /* 是否过载：有请求因队列已满被拒绝，还没有降到低水位 */
+    atomic<long> _dropNum;     /* 因请求队列已满而被拒绝的请求数 */
+    LockFreeQueue<Task>** _workQueues;  /* 请求队列数组，未处理的请求集合 */
+    int _queueNum;             /* 请求队列数量，调度模式0为1，调度模式1为线程数 */
+    atomic<int> _workerNum;    /* 已启动的工作线程数，用于分配工作线程的编号 */
+    atomic<int> _running;      /* 还没有退出的工作线程数，析构时等它降为0 */
+    atomic<bool> _stop;        /* 线程池正在析构，工作线程不再取请求 */
+    EventCount _notEmpty;      /* 请求队列非空的通知，工作线程在其上休眠 */
+    SqlPool* _sqlPool;         /* 数据库，请求在需要时从中获取连接 */
     int _actorMode;            /* 模型, 0:proactor; 1:reactor */
+    int _runToCompletion;      /* reactor模式下，处理完请求后是否直接发送响应，0:否; 1:是 */
+    ThreadPool* _dbLane;       /* 数据库通道，为NULL时所有请求都在本线程池处理 */
+    int _closeLog;             /* 日志开关，LOG_*宏使用 */
 };
 
 template<typename T>
-ThreadPool<T>::ThreadPool(int actorMode, SqlPool* sqlPool, int threadNum, int maxRequests):
-               _actorMode(actorMode), _sqlPool(sqlPool), _threadNum(threadNum), _maxRequests(maxRequests){
+ThreadPool<T>::ThreadPool(int actorMode, int runToCompletion, SqlPool* sqlPool, int threadNum, int maxRequests,
+               int schedMode, int maxThreadNum):
+               _actorMode(actorMode), _runToCompletion(runToCompletion), _sqlPool(sqlPool),
+               _threadNum(threadNum), _maxRequests(maxRequests){
     if(threadNum <= 0 || maxRequests <= 0){
         throw std::exception();
     }
     
-    _threads = new pthread_t[_threadNum];
-    if(!_threads){
-        throw std::exception();
+    /* 请求总数不超过maxRequests，平分给各个队列。无锁队列的容量是2的幂，取不小于平分值的最小值 */
+    _queueNum = (1 == schedMode) ? threadNum : 1;
+    int queueSize = 2;
+    while(queueSize < (maxRequests + _queueNum - 1) / _queueNum){
+        queueSize <<= 1;
     }
+    _workQueues = new LockFreeQueue<Task>*[_queueNum];
+    for(int i=0; i<_queueNum; ++i){
+        _workQueues[i] = new LockFreeQueue<Task>(queueSize);
+    }
+    _workerNum.store(0, memory_order_relaxed);
+    _running.store(0, memory_order_relaxed);
+    _stop.store(false, memory_order_relaxed);
+    _dbLane = NULL;
+    _closeLog = sqlPool->_closeLog;
+    _lowWater = maxRequests / 2;
+    _overloaded.store(false, memory_order_relaxed);
+    _dropNum.store(0, memory_order_relaxed);
+    /* 上限不大于下限时不伸缩 */
+    _maxThreadNum = maxThreadNum > threadNum ? maxThreadNum : threadNum;
+    _liveNum.store(threadNum, memory_order_relaxed);
+    _lastGrow.store(0, memory_order_relaxed);
 
-    /* 创建threadNum个线程,并设置线程分离 */
+    /* 创建threadNum个线程 */
     for(int i=0; i<threadNum; ++i){
-        if(pthread_create(_threads+i, NULL, worker, this) != 0 ){
-            delete[] _threads;
-            throw std::exception();
-        }
-        if(pthread_detach(_threads[i]) != 0){
-            delete[] _threads;
+        if(!addWorker()){
             throw std::exception();
         }
     }
 }
 
+/*
+* 功能：工作线程是分离的，先让它们全部退出，再释放请求队列。
+*       休眠的线程被唤醒后看到_stop直接退出，正在处理请求的线程处理完这个请求后退出，队列中剩下的请求被丢弃
+*/
 template<class T>
 ThreadPool<T>::~ThreadPool(){
-    delete[] _threads;
+    _stop.store(true);
+    while(_running.load() > 0){
+        /* 每次都重新唤醒，覆盖处理完请求后才开始等待的线程 */
+        _notEmpty.notifyAll();
+        usleep(1000);
+    }
+    for(int i=0; i<_queueNum; ++i){
+        delete _workQueues[i];
+    }
+    delete[] _workQueues;
+}
+
+/*
+* 功能：请求入队，有工作线程休眠则唤醒一个。多个队列时按连接的fd选择队列，
+*       同一连接的请求由同一工作线程处理，连接的数据留在该线程所在核的缓存中。
+*       新连接总是使用最小的空闲fd，连续的fd正好轮流落到各个队列中
+* 参数：
+*       --request：新请求
+* 返回值：请求队列已满时返回false
+*/
+template<class T>
+bool ThreadPool<T>::push(T* request){
+    Task task;
+    task._request = request;
+    task._enqueueTime = now();
+    int index = (unsigned)request->getSockFd() % _queueNum;
+    for(int i=0; i<_queueNum; ++i){
+        /* 选中的队列满了则放入下一个队列 */
+        if(_workQueues[(index + i) % _queueNum]->push(task)){
+            _notEmpty.notify();
+            return true;
+        }
+    }
+    /* 所有队列都满了，进入过载状态 */
+    _dropNum.fetch_add(1, memory_order_relaxed);
+    if(!_overloaded.load(memory_order_relaxed)){
+        _overloaded.store(true, memory_order_relaxed);
+    }
+    return false;
+}
+
+/*
+* 功能：是否过载。过载后排队的请求数降到低水位以下时解除，避免在满与不满之间反复切换
+*/
+template<class T>
+bool ThreadPool<T>::overloaded(){
+    if(!_overloaded.load(memory_order_relaxed)){
+        return false;
+    }
+    int depth = 0;
+    for(int i=0; i<_queueNum; ++i){
+        depth += _workQueues[i]->size();
+    }
+    if(depth > _lowWater){
+        return true;
+    }
+    _overloaded.store(false, memory_order_relaxed);
+    return false;
+}
+
+/*
+* 功能：先从自己的队列取请求，为空则依次从其他队列窃取
+* 参数：
+*       --id：工作线程编号
+*       --task：传出参数，取出的请求
+*/
+template<class T>
+bool ThreadPool<T>::tryPop(int id, Task& task){
+    int index = id % _queueNum;
+    for(int i=0; i<_queueNum; ++i){
+        if(_workQueues[(index + i) % _queueNum]->pop(task)){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+* 功能：取出一个请求，所有队列都为空时先让出CPU重试几次，仍为空再休眠直到有新的请求。
+*       请求连续到来时工作线程不进入休眠，生产者也就不需要futex唤醒，线程多于核数时差别最明显(见bench/queuebench.cpp)。
+*       请求排队过久则考虑增加线程；多余的线程空闲超时或线程池析构时返回NULL，线程退出
+* 参数：
+*       --id：工作线程编号
+*/
+template<class T>
+T* ThreadPool<T>::pop(int id){
+    Task task;
+    struct timespec timeout = {IDLE_TIMEOUT, 0};
+    int spins = 0;
+    while(true){
+        if(_stop.load()){
+            return NULL;
+        }
+        bool found = tryPop(id, task);
+        if(!found && ++spins < SPIN_BEFORE_WAIT){
+            sched_yield();
+            continue;
+        }
+        spins = 0;
+        if(!found){
+            /* 登记为等待者后再检查一次，避免错过登记前入队的请求和析构的通知 */
+            uint32_t key = _notEmpty.prepareWait();
+            if(_stop.load()){
+                _notEmpty.cancelWait();
+                return NULL;
+            }
+            if(tryPop(id, task)){
+                _notEmpty.cancelWait();
+                found = true;
+            }
+            else if(!_notEmpty.wait(key, _maxThreadNum > _threadNum ? &timeout : NULL)){
+                /* 空闲超时，线程数多于下限则退出 */
+                int live = _liveNum.load(memory_order_relaxed);
+                while(live > _threadNum){
+                    if(_liveNum.compare_exchange_weak(live, live - 1, memory_order_relaxed)){
+                        LOG_INFO("thread pool shrinks to %d threads", live - 1);
+                        return NULL;
+                    }
+                }
+            }
+        }
+        if(found){
+            if(_maxThreadNum > _threadNum){
+                int64_t current = now();
+                grow(current - task._enqueueTime, current);
+            }
+            return task._request;
+        }
+    }
+}
+
+/*
+* 功能：请求排队时间过长，并且所有线程都在忙(如阻塞在数据库上)时，增加一个线程
+* 参数：
+*       --waitTime：刚取出的请求的排队时间(us)
+*       --current：当前时间(us)
+*/
+template<class T>
+void ThreadPool<T>::grow(int64_t waitTime, int64_t current){
+    if(waitTime < MAX_QUEUE_WAIT || _notEmpty.waiters() > 0){
+        return;
+    }
+    /* 限制增加线程的频率，新线程还没开始工作时不重复增加 */
+    int64_t last = _lastGrow.load(memory_order_relaxed);
+    if(current - last < GROW_INTERVAL || !_lastGrow.compare_exchange_strong(last, current, memory_order_relaxed)){
+        return;
+    }
+    int live = _liveNum.load(memory_order_relaxed);
+    while(live < _maxThreadNum){
+        if(_liveNum.compare_exchange_weak(live, live + 1, memory_order_relaxed)){
+            if(addWorker()){
+                LOG_INFO("thread pool grows to %d threads, queue wait %lld us", live + 1, (long long)waitTime);
+            }
+            else{
+                _liveNum.fetch_sub(1, memory_order_relaxed);
+                LOG_ERROR("%s", "thread pool fails to create thread");
+            }
+            return;
+        }
+    }
+}
+
+/*
+* 功能：创建一个工作线程，并设置线程分离。线程创建前计入_running，析构不会错过刚创建的线程
+*/
+template<class T>
+bool ThreadPool<T>::addWorker(){
+    pthread_t thread;
+    _running.fetch_add(1);
+    if(pthread_create(&thread, NULL, worker, this) != 0){
+        _running.fetch_sub(1);
+        return false;
+    }
+    if(pthread_detach(thread) != 0){
+        return false;
+    }
+    return true;
+}
+
+/*
+* 功能：单调时钟的当前时间，单位us
+*/
+template<class T>
+int64_t ThreadPool<T>::now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 /*
@@ -76,19 +331,9 @@ ThreadPool<T>::~ThreadPool(){
 */
 template<class T>
 bool ThreadPool<T>::append(T* request, int state){
-    /* 上锁 */
-    _locker.lock();
-    /* 请求队列已满,无法添加新的请求 */
-    if(_workQueue.size() >= _maxRequests){
-        _locker.unlock();
-        return false;
-    }
-    /* 设置请求状态，将其加入请求队列，同时将未处理的请求数+1 */
+    /* 设置请求状态，将其加入请求队列，入队失败说明请求队列已满 */
     request->_state = state;
-    _workQueue.push_back(request);
-    _locker.unlock();
-    _unsettledNum.post();
-    return true;
+    return push(request);
 }
 
 /*
@@ -99,19 +344,8 @@ bool ThreadPool<T>::append(T* request, int state){
 */
 template<class T>
 bool ThreadPool<T>::appendP(T* request){
-        /* 上锁 */
-    _locker.lock();
-    /* 请求队列已满,无法添加新的请求 */
-    if(_workQueue.size() >= _maxRequests){
-        _locker.unlock();
-        return false;
-    }
-    /* 将其加入请求队列*/
-    _workQueue.push_back(request);
-    _locker.unlock();
-    /* 将未处理的请求数+1, 通过信号量通知，工作线程开始工作 */
-    _unsettledNum.post();
-    return true;
+    /* 将其加入请求队列，入队失败说明请求队列已满 */
+    return push(request);
 }
 
 /*
@@ -131,63 +365,89 @@ void* ThreadPool<T>::worker(void* arg){
 */
 template<class T>
 void ThreadPool<T>::run(){
+    int id = _workerNum.fetch_add(1, memory_order_relaxed);
+    /* 独占模式下为本线程创建数据库连接 */
+    _sqlPool->pinConnection();
     /* 等待新的请求到来 */
     while(true){
         /* 无请求时，工作线程处于阻塞状态；有未处理的请求时，则解除阻塞，进行处理*/
-        _unsettledNum.wait();
-        _locker.lock();
-        if(_workQueue.empty()){
-            _locker.unlock();
-            continue;
-        }
-
-        /* 取出新请求 */
-        T* request = _workQueue.front();
-        _workQueue.pop_front();
-        _locker.unlock();
+        T* request = pop(id);
         if(request == NULL){
-            continue;
+            /* 多余的线程空闲超时或线程池析构，退出。_running减为0后线程池可能已被释放，之后不能再访问成员 */
+            _sqlPool->unpinConnection();
+            _running.fetch_sub(1);
+            return;
         }
 
-        if(1 == _actorMode){
-            /* reactor */
-            if(0 == request->_state){
-                /* 读数据 */
-                if(request->readOnce()){
-                    /* 读取成功 */
-                    request->_improv = 1;
-                    ConnRAII mysqlCon(&request->_mysql, _sqlPool);
-                    /* 进行数据处理 */
-                    request->process();
-                }
-                else{
-                    /* 读失败 */
-                    request->_improv = 1;
-                    request->_timerFlag = 1;
-                }
+        if(1 == _actorMode && 0 == request->_state){
+            /* reactor: 读数据，处理结果通过rearm交回事件循环，事件循环不等待 */
+            if(request->readOnce()){
+                serve(request);
             }
             else{
-                /* 写数据 */
-                if(request->write()){
-                    /* 写成功 */
-                    request->_improv = 1;
-                }
-                else{
-                    /* 写失败 */
-                    request->_improv = 1;
-                    request->_timerFlag = 1;
-                }
+                /* 读失败，由事件循环关闭连接 */
+                request->rearm(0);
+            }
+        }
+        else if(1 == _actorMode && 1 == request->_state){
+            /* reactor: 写数据，写失败由事件循环关闭连接 */
+            if(!request->write()){
+                request->rearm(0);
             }
         }
         else{
-            /*  proactor */
-            ConnRAII mysqlCon(&request->_mysql, _sqlPool);
-            /* 进行数据处理 */
-            request->process();
+            /* proactor，或者其他通道交来的请求 */
+            serve(request);
         }
     }
 }
 
+/*
+* 功能：处理已经读入的请求。数据库连接由请求在需要时自己获取。
+*       注册请求优先交给事件循环异步执行插入；
+*       有数据库通道时，其余需要访问数据库的请求解析后交给数据库通道，本通道不会因数据库阻塞
+* 参数：
+*       --request：请求
+*/
+template<class T>
+void ThreadPool<T>::serve(T* request){
+    int ev;
+    if(2 == request->_state){
+        /* 其他通道解析后交来的请求 */
+        request->_state = 0;
+        ev = request->respond(T::GET_REQUEST);
+    }
+    else{
+        typename T::HTTP_CODE code = request->parse();
+        if(code == T::GET_REQUEST && request->needDatabase()){
+            if(request->startAsyncSql()){
+                /* 由事件循环异步执行插入，完成后再交回线程池 */
+                return;
+            }
+            if(_dbLane){
+                /* 交给数据库通道，数据库通道已满则返回503并关闭连接 */
+                request->_state = 2;
+                if(!_dbLane->push(request)){
+                    request->sendBusy();
+                    request->rearm(0);
+                }
+                return;
+            }
+        }
+        ev = request->respond(code);
+    }
+
+    if(1 == _actorMode && 1 == _runToCompletion && EPOLLOUT == ev){
+        /* 处理请求后直接发送响应，只有写缓冲区满了才注册EPOLLOUT，写失败由事件循环关闭连接 */
+        if(!request->write()){
+            request->rearm(0);
+        }
+    }
+    else{
+        request->rearm(ev);
+    }
+}
+
 #endif
 
 
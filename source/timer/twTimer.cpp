@@ -75,6 +75,9 @@ void SortTimerWheel::adjustTimer(UtilTimer* timer, int time){
             timer->_next->_prev = timer->_prev;
         }
     }
+    /* 清除旧的链接，避免重新插入后残留指向原槽中的定时器 */
+    timer->_prev = NULL;
+    timer->_next = NULL;
 
     /* 下面根据定时器时间值time来设定该定时器的时长是多少个时间槽间隔 */
     int ticks = 0;
@@ -84,9 +87,9 @@ void SortTimerWheel::adjustTimer(UtilTimer* timer, int time){
     else{
         ticks = time / SI;
     }
-    /* 计算定时器时长对应的圈数以及应该被插在哪个时间槽中 */
-    int rotation = timer->_rotation +  (ticks + timer->_slot) / N;
-    ts = (timer->_slot + ticks) % N;
+    /* 从当前时刻重新计时，计算定时器时长对应的圈数以及应该被插在哪个时间槽中 */
+    int rotation = ticks / N;
+    ts = (_curSlot + (ticks%N)) % N;
     timer->_rotation = rotation;
     timer->_slot = ts;
     /* 将定时器插入对应的槽中 */
@@ -171,8 +174,29 @@ void SortTimerWheel::tick(){
 *参数：  --uesrData：超时的连接
 */
 void cb_func(ClientData* userData){
-    epoll_ctl(Utils::_epollFd, EPOLL_CTL_DEL, userData->_sockFd, NULL);
     assert(userData);
+    /* io_uring中仍在等待的recv持有socket的引用，只close不会结束连接；
+       处理中的连接shutdown后，工作线程的读写会立即失败 */
+    shutdown(userData->_sockFd, SHUT_RDWR);
+    /* 定时器随后被删除，置空表示连接已关闭 */
+    userData->_timer = NULL;
+    if(userData->_busy){
+        /* 工作线程还在使用连接。此时close, fd会被新连接重用，新连接的初始化和工作线程同时修改同一个HttpConn，
+           推迟到连接交还事件循环时再关闭 */
+        userData->_closing = true;
+        return;
+    }
+    close_func(userData);
+}
+
+/*
+*功能：关闭连接的socket，定时器到期或连接处理结束时调用
+*参数：  --uesrData：要关闭的连接
+*/
+void close_func(ClientData* userData){
+    epoll_ctl(userData->_epollFd, EPOLL_CTL_DEL, userData->_sockFd, NULL);
     close(userData->_sockFd);
+    userData->_busy = false;
+    userData->_closing = false;
     HttpConn::_userCount--;
 }
\ No newline at end of file
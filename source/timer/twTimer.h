@@ -26,7 +26,10 @@ class UtilTimer;
 struct ClientData{
     sockaddr_in _address;   /* 用户地址 */
     int _sockFd;     /* 连接fd */
-    UtilTimer* _timer;   /* 定时器 */
+    int _epollFd;    /* 连接所属事件循环的epoll */
+    UtilTimer* _timer;   /* 定时器，连接关闭或到期后为NULL */
+    bool _busy;      /* 连接正被工作线程处理，或io_uring的发送还没有完成 */
+    bool _closing;   /* 处理期间定时器到期或对方关闭了连接，处理结束后关闭 */
 };
 
 /* 定时器类 */
@@ -54,9 +57,10 @@ public:
     void deleteTimer(UtilTimer* timer);
     void adjustTimer(UtilTimer* timer, int time);
     void tick();
+
+    static const int N = 60;    /* 时间轮上的槽数 */
+    static const int SI = 500;  /* 时针转动一次的时间, 单位ms */
 private:
-    static const int N = 60;  /* 时间轮上的槽数 */
-    static const int SI = 5;  /* 时针转动一次的时间, 单位s */
     int _curSlot;             /* 时针指向的当前槽 */
     UtilTimer* _slots[N];     /* 时间轮数组，存放定时器 */
 };
@@ -67,4 +71,10 @@ private:
 */
 void cb_func(ClientData* userData);
 
+/*
+*功能：关闭连接的socket，定时器到期或连接处理结束时调用
+*参数：  --uesrData：要关闭的连接
+*/
+void close_func(ClientData* userData);
+
 #endif
\ No newline at end of file
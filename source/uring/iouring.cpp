@@ -0,0 +1,290 @@
+#include "iouring.h"
+
+IoUring::IoUring(){
+    _ringFd = -1;
+    _extArg = false;
+    _sqRing = MAP_FAILED;
+    _cqRing = MAP_FAILED;
+    _sqes = (io_uring_sqe*)MAP_FAILED;
+    _sqRingSize = 0;
+    _cqRingSize = 0;
+    _sqesSize = 0;
+    _sqeTail = 0;
+    _bufs = NULL;
+    _bufNum = 0;
+    _bufSize = 0;
+    _groupId = 0;
+    _bufRing = (io_uring_buf_ring*)MAP_FAILED;
+    _bufRingSize = 0;
+    _bufTail = 0;
+}
+
+IoUring::~IoUring(){
+    if(_sqes != MAP_FAILED) munmap(_sqes, _sqesSize);
+    if(_cqRing != MAP_FAILED && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+    if(_sqRing != MAP_FAILED) munmap(_sqRing, _sqRingSize);
+    if(_ringFd != -1) close(_ringFd);
+    /* io_uring关闭后内核不再使用缓冲区环和缓冲区 */
+    if(_bufRing != MAP_FAILED) munmap(_bufRing, _bufRingSize);
+    delete[] _bufs;
+}
+
+/*
+*功能：创建io_uring实例，映射提交队列和完成队列
+*参数：entries: 提交队列的长度
+*返回值：是否创建成功
+*/
+bool IoUring::init(unsigned entries){
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    _ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    if(_ringFd < 0){
+        return false;
+    }
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    _extArg = (params.features & IORING_FEAT_EXT_ARG) != 0;
+    /* 新内核中提交队列和完成队列可以一次映射 */
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(_cqRingSize > _sqRingSize) _sqRingSize = _cqRingSize;
+        _cqRingSize = _sqRingSize;
+    }
+    _sqRing = mmap(0, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   _ringFd, IORING_OFF_SQ_RING);
+    if(_sqRing == MAP_FAILED){
+        return false;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        _cqRing = _sqRing;
+    }
+    else{
+        _cqRing = mmap(0, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       _ringFd, IORING_OFF_CQ_RING);
+        if(_cqRing == MAP_FAILED){
+            return false;
+        }
+    }
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe*)mmap(0, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                _ringFd, IORING_OFF_SQES);
+    if(_sqes == MAP_FAILED){
+        return false;
+    }
+
+    char* sq = (char*)_sqRing;
+    _sqHead = (unsigned*)(sq + params.sq_off.head);
+    _sqTail = (unsigned*)(sq + params.sq_off.tail);
+    _sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    _sqArray = (unsigned*)(sq + params.sq_off.array);
+    _sqEntries = params.sq_entries;
+    _sqeTail = *_sqTail;
+
+    char* cq = (char*)_cqRing;
+    _cqHead = (unsigned*)(cq + params.cq_off.head);
+    _cqTail = (unsigned*)(cq + params.cq_off.tail);
+    _cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    _cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+/*
+*功能：取得一个空闲的提交项，提交队列满了则先提交给内核
+*/
+io_uring_sqe* IoUring::getSqe(){
+    while(_sqeTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries){
+        submitAndWait(0);
+    }
+    unsigned idx = _sqeTail & *_sqMask;
+    io_uring_sqe* sqe = &_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    _sqArray[idx] = idx;
+    _sqeTail++;
+    return sqe;
+}
+
+/*
+*功能：一次系统调用提交所有已填好的提交项，并等待完成项
+*参数：
+*     --waitNum: 至少等待的完成项数量
+*     --timeout: 等待的最长时间，单位ms，-1表示一直等待；内核不支持时忽略
+*返回值：提交的数量，超时返回-ETIME，失败返回-errno
+*/
+int IoUring::submitAndWait(unsigned waitNum, int timeout){
+    unsigned toSubmit = _sqeTail - *_sqTail;
+    __atomic_store_n(_sqTail, _sqeTail, __ATOMIC_RELEASE);
+    /* 已有完成项时不再阻塞 */
+    if(waitNum > 0 && peekCqe() != NULL){
+        waitNum = 0;
+    }
+    if(toSubmit == 0 && waitNum == 0){
+        return 0;
+    }
+    int ret;
+    if(waitNum > 0 && timeout >= 0 && _extArg){
+        __kernel_timespec ts;
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)&ts;
+        ret = syscall(__NR_io_uring_enter, _ringFd, toSubmit, waitNum,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+    else{
+        ret = syscall(__NR_io_uring_enter, _ringFd, toSubmit, waitNum,
+                      waitNum > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    }
+    return ret < 0 ? -errno : ret;
+}
+
+/*
+*功能：取得下一个完成项，处理后调用seenCqe
+*返回值：没有完成项返回NULL
+*/
+io_uring_cqe* IoUring::peekCqe(){
+    unsigned head = *_cqHead;
+    if(head == __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)){
+        return NULL;
+    }
+    return &_cqes[head & *_cqMask];
+}
+
+/*
+*功能：标记一个完成项已处理，内核可以重用该位置
+*/
+void IoUring::seenCqe(){
+    __atomic_store_n(_cqHead, *_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/*
+*功能：向内核注册缓冲区环(IORING_REGISTER_PBUF_RING)，recv时由内核从环中选取缓冲区，
+*     不需要为每个连接准备接收缓冲区，放回缓冲区也不需要提交项
+*参数：
+*     --groupId: 缓冲区组号
+*     --bufNum: 缓冲区个数，必须是2的幂
+*     --bufSize: 每个缓冲区的大小
+*返回值：是否注册成功，内核不支持(5.19以前)时返回false
+*/
+bool IoUring::setupBufs(int groupId, int bufNum, int bufSize){
+    _groupId = groupId;
+    _bufNum = bufNum;
+    _bufSize = bufSize;
+    _bufs = new char[bufNum * bufSize];
+
+    /* 环的内存必须按页对齐，匿名映射的内存初始为0，环尾也是0 */
+    _bufRingSize = bufNum * sizeof(io_uring_buf);
+    _bufRing = (io_uring_buf_ring*)mmap(NULL, _bufRingSize, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(_bufRing == MAP_FAILED){
+        return false;
+    }
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)_bufRing;
+    reg.ring_entries = bufNum;
+    reg.bgid = groupId;
+    if(syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+        return false;
+    }
+    _bufTail = 0;
+    for(int i=0; i<bufNum; ++i){
+        recycleBuf(i);
+    }
+    return true;
+}
+
+/*
+*功能：取得缓冲区的首地址
+*参数：bufId: 完成项中内核选取的缓冲区编号
+*/
+char* IoUring::getBuf(int bufId){
+    return _bufs + bufId * _bufSize;
+}
+
+/*
+*功能：数据取走后，将缓冲区放回环尾，发布新的环尾后内核即可再次选取
+*参数：bufId: 缓冲区编号
+*/
+void IoUring::recycleBuf(int bufId){
+    /* 环就是io_uring_buf数组。内核头文件按C++编译时，__DECLARE_FLEX_ARRAY中的空结构体占位，
+       bufs的偏移是8而不是0，不能用_bufRing->bufs取项，否则内核看到的都是错位的项，recv总是ENOBUFS。
+       环尾和第0项的resv字段重叠，只能逐个字段填写，整体赋值会把环尾清零 */
+    io_uring_buf* buf = (io_uring_buf*)_bufRing + (_bufTail & (_bufNum - 1));
+    buf->addr = (uint64_t)getBuf(bufId);
+    buf->len = _bufSize;
+    buf->bid = bufId;
+    _bufTail++;
+    __atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+}
+
+/*
+*功能：multishot accept, 一次提交持续接受新连接，新连接设置为非阻塞
+*/
+void IoUring::prepAccept(int fd, uint64_t userData){
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = userData;
+}
+
+/*
+*功能：multishot recv, 一次提交持续接收数据，数据放在内核选取的缓冲区里
+*/
+void IoUring::prepRecv(int fd, uint64_t userData){
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = _groupId;
+    sqe->user_data = userData;
+}
+
+/*
+*功能：发送iv中的数据
+*/
+void IoUring::prepWritev(int fd, const struct iovec* iv, int ivCount, uint64_t userData){
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)iv;
+    sqe->len = ivCount;
+    sqe->user_data = userData;
+}
+
+/*
+*功能：读取fd，用于信号管道和eventfd
+*/
+void IoUring::prepRead(int fd, void* buf, unsigned len, uint64_t userData){
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->user_data = userData;
+}
+
+/*
+*功能：监测fd上的事件一次，相当于EPOLLONESHOT
+*/
+void IoUring::prepPoll(int fd, unsigned mask, uint64_t userData){
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = mask;
+    sqe->user_data = userData;
+}
+
+/*
+*功能：取消user_data为target的请求，被取消的请求以-ECANCELED完成
+*/
+void IoUring::prepCancel(uint64_t target, uint64_t userData){
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+}
@@ -0,0 +1,76 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-12
+@Detail    : io_uring的封装类，直接使用系统调用，管理提交队列、完成队列和提供给内核的接收缓冲区
+@Reference : https://kernel.dk/io_uring.pdf
+*/
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+/* io_uring类：一个事件循环拥有一个io_uring实例，只在事件循环线程中使用 */
+class IoUring{
+public:
+    IoUring();
+    ~IoUring();
+
+    bool init(unsigned entries);
+    int submitAndWait(unsigned waitNum, int timeout = -1);
+    io_uring_cqe* peekCqe();
+    void seenCqe();
+
+    bool setupBufs(int groupId, int bufNum, int bufSize);
+    char* getBuf(int bufId);
+    void recycleBuf(int bufId);
+
+    void prepAccept(int fd, uint64_t userData);
+    void prepRecv(int fd, uint64_t userData);
+    void prepWritev(int fd, const struct iovec* iv, int ivCount, uint64_t userData);
+    void prepRead(int fd, void* buf, unsigned len, uint64_t userData);
+    void prepPoll(int fd, unsigned mask, uint64_t userData);
+    void prepCancel(uint64_t target, uint64_t userData);
+
+private:
+    io_uring_sqe* getSqe();
+
+    int _ringFd;           /* io_uring的文件描述符 */
+    bool _extArg;          /* 内核支持IORING_ENTER_EXT_ARG, 等待完成项时可以设置超时 */
+    void* _sqRing;         /* 提交队列的映射地址 */
+    void* _cqRing;         /* 完成队列的映射地址 */
+    size_t _sqRingSize;
+    size_t _cqRingSize;
+    io_uring_sqe* _sqes;   /* 提交队列项数组 */
+    size_t _sqesSize;
+
+    unsigned* _sqHead;     /* 内核修改，已经取走的提交项 */
+    unsigned* _sqTail;     /* 用户修改，已经填好的提交项 */
+    unsigned* _sqMask;
+    unsigned* _sqArray;
+    unsigned _sqEntries;
+    unsigned _sqeTail;     /* 下一个可以填写的提交项，submit时发布到_sqTail */
+
+    unsigned* _cqHead;     /* 用户修改，已经处理的完成项 */
+    unsigned* _cqTail;     /* 内核修改，已经产生的完成项 */
+    unsigned* _cqMask;
+    io_uring_cqe* _cqes;
+
+    char* _bufs;           /* 提供给内核的缓冲区内存，multishot recv从中选取缓冲区 */
+    int _bufNum;           /* 缓冲区个数，2的幂 */
+    int _bufSize;
+    int _groupId;          /* 缓冲区组号 */
+    io_uring_buf_ring* _bufRing;  /* 注册给内核的缓冲区环，内核从环头取缓冲区，用户在环尾放回 */
+    size_t _bufRingSize;
+    unsigned short _bufTail;      /* 环尾，放回缓冲区后发布到_bufRing->tail */
+};
+
+#endif
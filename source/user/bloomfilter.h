@@ -0,0 +1,92 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-25
+@Detail    : 用户名的布隆过滤器，判定用户名一定不存在时不需要访问数据库
+@Reference : https://www.cs.amherst.edu/~ccmcgeoch/cs34/papers/cacheefficientbloomfilters-jea.pdf
+*/
+
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <atomic>
+#include <stdint.h>
+using namespace std;
+
+/* 每个用户占用的位数，约1%的误判率 */
+const int BLOOM_BITS_PER_USER = 10;
+
+/* 分块的布隆过滤器：每个用户名的BLOOM_HASHES个位都在同一个64字节的块中，一次查询只访问一个缓存行。
+   位数组由原子变量组成，加入用fetch_or，查询不加锁；位只会被置1，查询可能误判存在，不会误判不存在。
+   大小在创建时确定，用户数超过预计的数量后误判率上升，但结果仍然正确 */
+class BloomFilter{
+public:
+    /*
+    *功能：创建过滤器
+    *参数：
+    *      --users: 预计的用户数量
+    */
+    BloomFilter(long users){
+        long blocks = 1;
+        while(blocks * BLOCK_BITS < users * BLOOM_BITS_PER_USER){
+            blocks <<= 1;
+        }
+        _blockMask = blocks - 1;
+        _words = new atomic<uint64_t>[blocks * BLOCK_WORDS];
+        for(long i=0; i<blocks * BLOCK_WORDS; ++i){
+            _words[i].store(0, memory_order_relaxed);
+        }
+    }
+    ~BloomFilter(){
+        delete[] _words;
+    }
+
+    /*
+    *功能：加入一个用户名
+    *参数：
+    *      --hash: 用户名的64位哈希值
+    */
+    void add(uint64_t hash){
+        atomic<uint64_t>* block = blockOf(hash);
+        uint64_t bits = bitsOf(hash);
+        for(int i=0; i<BLOOM_HASHES; ++i, bits >>= 9){
+            block[(bits >> 6) & 7].fetch_or(1ULL << (bits & 63), memory_order_relaxed);
+        }
+    }
+
+    /*
+    *功能：用户名是否可能存在，返回false时一定不存在
+    */
+    bool mayContain(uint64_t hash){
+        atomic<uint64_t>* block = blockOf(hash);
+        uint64_t bits = bitsOf(hash);
+        for(int i=0; i<BLOOM_HASHES; ++i, bits >>= 9){
+            if(!(block[(bits >> 6) & 7].load(memory_order_relaxed) & (1ULL << (bits & 63)))){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* 占用的内存 */
+    long bytes(){
+        return (_blockMask + 1) * BLOCK_WORDS * sizeof(uint64_t);
+    }
+
+private:
+    static const int BLOCK_WORDS = 8;                  /* 每块8个字，即一个缓存行 */
+    static const int BLOCK_BITS = BLOCK_WORDS * 64;    /* 每块的位数 */
+    static const int BLOOM_HASHES = 7;                 /* 每个用户名置位的个数，每个用9位在块中选位 */
+
+    /* 用哈希值的一部分重新混合后选块，另一部分选块中的位，两者不相关 */
+    atomic<uint64_t>* blockOf(uint64_t hash){
+        return _words + (((hash * 0x9E3779B97F4A7C15ULL) >> 32) & _blockMask) * BLOCK_WORDS;
+    }
+    static uint64_t bitsOf(uint64_t hash){
+        return (hash ^ (hash >> 31)) * 0xBF58476D1CE4E5B9ULL;
+    }
+
+    atomic<uint64_t>* _words;   /* 位数组 */
+    long _blockMask;            /* 块数量减1，块数量是2的幂 */
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "sessiontable.h"
+#include <sys/random.h>
+#include <ctype.h>
+#include "../timer/twTimer.h"
+
+SessionTable::SessionTable(){
+    for(int i=0; i<SHARD_NUM; ++i){
+        Shard* shard = _shards + i;
+        shard->_buckets = new Session*[INIT_BUCKETS];
+        memset(shard->_buckets, 0, sizeof(Session*) * INIT_BUCKETS);
+        shard->_mask = INIT_BUCKETS - 1;
+        shard->_count = 0;
+    }
+    memset(_wheels, 0, sizeof(_wheels));
+    _now.store(0, memory_order_relaxed);
+    /* 时钟由timerfd驱动，每SortTimerWheel::SI毫秒一次 */
+    _ttl = (uint32_t)SESSION_TTL * 1000 / SortTimerWheel::SI;
+}
+
+SessionTable::~SessionTable(){
+    for(int i=0; i<SHARD_NUM; ++i){
+        Shard* shard = _shards + i;
+        for(int j=0; j<=shard->_mask; ++j){
+            Session* session = shard->_buckets[j];
+            while(session){
+                Session* next = session->_next;
+                delete session;
+                session = next;
+            }
+        }
+        delete[] shard->_buckets;
+    }
+}
+
+/*
+*功能：单例模式，所有连接共用一张会话表
+*/
+SessionTable* SessionTable::getInstance(){
+    static SessionTable sessionTable;
+    return &sessionTable;
+}
+
+/*
+*功能：将十六进制的令牌转换为原始字节
+*参数：
+*      --token: 令牌，之后可以有其他字符
+*      --key: 传出参数，SESSION_TOKEN_LEN/2个字节
+*返回值：格式不对返回false
+*/
+bool SessionTable::parse(const char* token, uint8_t* key){
+    for(int i=0; i<SESSION_TOKEN_LEN; ++i){
+        if(!isxdigit((unsigned char)token[i])){
+            return false;
+        }
+    }
+    if(isxdigit((unsigned char)token[SESSION_TOKEN_LEN])){
+        return false;
+    }
+    for(int i=0; i<SESSION_TOKEN_LEN / 2; ++i){
+        int hi = tolower((unsigned char)token[2*i]);
+        int lo = tolower((unsigned char)token[2*i + 1]);
+        hi = isdigit(hi) ? hi - '0' : hi - 'a' + 10;
+        lo = isdigit(lo) ? lo - '0' : lo - 'a' + 10;
+        key[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
+/*
+*功能：令牌是随机数，前8个字节直接作为哈希值，高位选分片，低位选桶
+*/
+uint64_t SessionTable::hashOf(const uint8_t* key){
+    uint64_t h;
+    memcpy(&h, key, sizeof(h));
+    return h;
+}
+
+/*
+*功能：登录成功后创建会话
+*参数：
+*      --name: 用户名
+*      --token: 传出参数，新的令牌，至少SESSION_TOKEN_LEN+1字节
+*返回值：取不到随机数时返回false，不发放令牌
+*/
+bool SessionTable::create(const char* name, char* token){
+    Session* session = new Session;
+    if(getrandom(session->_key, sizeof(session->_key), 0) != (ssize_t)sizeof(session->_key)){
+        delete session;
+        return false;
+    }
+    static const char digits[] = "0123456789abcdef";
+    for(int i=0; i<SESSION_TOKEN_LEN / 2; ++i){
+        token[2*i] = digits[session->_key[i] >> 4];
+        token[2*i + 1] = digits[session->_key[i] & 0xf];
+    }
+    token[SESSION_TOKEN_LEN] = '\0';
+    strncpy(session->_name, name, sizeof(session->_name) - 1);
+    session->_name[sizeof(session->_name) - 1] = '\0';
+
+    uint64_t h = hashOf(session->_key);
+    Shard* shard = shardOf(h);
+    shard->_locker.lock();
+    session->_expire = _now.load(memory_order_relaxed) + _ttl;
+    Session** bucket = shard->_buckets + (h & shard->_mask);
+    session->_next = *bucket;
+    *bucket = session;
+    Session** slot = slotOf(shard, session->_expire);
+    session->_wheelNext = *slot;
+    *slot = session;
+    if(++shard->_count > shard->_mask + 1){
+        grow(shard);
+    }
+    shard->_locker.unlock();
+    return true;
+}
+
+/*
+*功能：令牌是否对应一个有效的会话，有效则重新计时
+*参数：
+*      --token: 请求的Cookie中的令牌
+*      --name: 请求提交的用户名，不为NULL时会话还必须属于该用户
+*/
+bool SessionTable::touch(const char* token, const char* name){
+    uint8_t key[SESSION_TOKEN_LEN / 2];
+    if(token == NULL || !parse(token, key)){
+        return false;
+    }
+    uint64_t h = hashOf(key);
+    Shard* shard = shardOf(h);
+    bool valid = false;
+    shard->_locker.lock();
+    uint32_t now = _now.load(memory_order_relaxed);
+    for(Session* session = shard->_buckets[h & shard->_mask]; session; session = session->_next){
+        if(memcmp(session->_key, key, sizeof(key)) == 0){
+            /* 已经到期但时间轮还没有转到的会话同样无效 */
+            if(session->_expire > now && (name == NULL || strcmp(session->_name, name) == 0)){
+                /* 只更新到期时间，时间轮转到原来的槽时再移动 */
+                session->_expire = now + _ttl;
+                valid = true;
+            }
+            break;
+        }
+    }
+    shard->_locker.unlock();
+    return valid;
+}
+
+/*
+*功能：桶数量加倍，重新分配各个会话
+*/
+void SessionTable::grow(Shard* shard){
+    int num = (shard->_mask + 1) * 2;
+    Session** buckets = new Session*[num];
+    memset(buckets, 0, sizeof(Session*) * num);
+    for(int i=0; i<=shard->_mask; ++i){
+        Session* session = shard->_buckets[i];
+        while(session){
+            Session* next = session->_next;
+            Session** bucket = buckets + (hashOf(session->_key) & (num - 1));
+            session->_next = *bucket;
+            *bucket = session;
+            session = next;
+        }
+    }
+    delete[] shard->_buckets;
+    shard->_buckets = buckets;
+    shard->_mask = num - 1;
+}
+
+/*
+*功能：将会话从哈希表中移除
+*/
+void SessionTable::unlink(Shard* shard, Session* session){
+    Session** p = shard->_buckets + (hashOf(session->_key) & shard->_mask);
+    while(*p && *p != session){
+        p = &(*p)->_next;
+    }
+    if(*p){
+        *p = session->_next;
+        --shard->_count;
+    }
+}
+
+/*
+*功能：时间轮转到now对应的槽，删除其中到期的会话，被使用过的会话挂到新的到期时间对应的槽中
+*/
+void SessionTable::sweep(Shard* shard, uint32_t now){
+    Session** slot = slotOf(shard, now);
+    Session* session = *slot;
+    *slot = NULL;
+    while(session){
+        Session* next = session->_wheelNext;
+        if(session->_expire <= now){
+            unlink(shard, session);
+            delete session;
+        }
+        else{
+            Session** newSlot = slotOf(shard, session->_expire);
+            session->_wheelNext = *newSlot;
+            *newSlot = session;
+        }
+        session = next;
+    }
+}
+
+/*
+*功能：0号事件循环的timerfd到期时调用，时间轮前进
+*参数：
+*      --ticks: timerfd到期的次数
+*/
+void SessionTable::tick(uint64_t ticks){
+    /* 错过的时钟超过一圈时，只需每个槽转过一次 */
+    if(ticks > WHEEL_SLOTS){
+        _now.fetch_add(ticks - WHEEL_SLOTS, memory_order_relaxed);
+        ticks = WHEEL_SLOTS;
+    }
+    for(uint64_t i=0; i<ticks; ++i){
+        uint32_t now = _now.fetch_add(1, memory_order_relaxed) + 1;
+        for(int j=0; j<SHARD_NUM; ++j){
+            Shard* shard = _shards + j;
+            shard->_locker.lock();
+            sweep(shard, now);
+            shard->_locker.unlock();
+        }
+    }
+}
+
+/*
+*功能：会话总数，只用于统计
+*/
+long SessionTable::size(){
+    long num = 0;
+    for(int i=0; i<SHARD_NUM; ++i){
+        _shards[i]._locker.lock();
+        num += _shards[i]._count;
+        _shards[i]._locker.unlock();
+    }
+    return num;
+}
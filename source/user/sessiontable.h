@@ -0,0 +1,80 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-23
+@Detail    : 会话表，登录成功后发放令牌，之后带有效令牌的登录请求不再比较密码。
+             请求提交了用户名时令牌必须属于该用户，否则仍按用户名和密码登录。
+             分片的哈希表，过期由时间轮驱动
+@Reference : http://www.cs.columbia.edu/~nahum/w6998/papers/ton97-timing-wheels.pdf
+*/
+
+#ifndef SESSIONTABLE_H
+#define SESSIONTABLE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include "../locker/locker.h"
+using namespace std;
+
+/* 会话的有效期，单位s，期间每次使用都重新计时 */
+const int SESSION_TTL = 1800;
+/* 令牌的长度，16个随机字节的十六进制表示 */
+const int SESSION_TOKEN_LEN = 32;
+/* Cookie中令牌的名字 */
+const char SESSION_COOKIE[] = "sid";
+
+/* 会话表类：按令牌分到SHARD_NUM个分片，每个分片一张链式哈希表和一个时间轮，各由分片的锁保护。
+   令牌是随机数，直接取前8个字节作为哈希值。会话按到期的时钟数挂在时间轮的槽中，
+   0号事件循环的timerfd每次到期调用tick()，转过的槽中到期的会话被删除；
+   期间被使用过的会话只更新到期时间，转到时再挂到新的槽中，使用时不需要移动 */
+class SessionTable{
+public:
+    static SessionTable* getInstance();
+    bool create(const char* name, char* token);
+    bool touch(const char* token, const char* name = NULL);
+    void tick(uint64_t ticks);
+    long size();
+
+private:
+    SessionTable();
+    ~SessionTable();
+
+    /* 一个会话，同时在哈希表的链表和时间轮的链表中 */
+    struct Session{
+        uint8_t _key[SESSION_TOKEN_LEN / 2];  /* 令牌的原始字节 */
+        char _name[100];       /* 登录的用户名 */
+        uint32_t _expire;      /* 到期的时钟数 */
+        Session* _next;        /* 哈希表同一个桶中的下一个会话 */
+        Session* _wheelNext;   /* 时间轮同一个槽中的下一个会话 */
+    };
+    /* 分片，按缓存行对齐，不同分片的锁不在同一缓存行 */
+    struct alignas(64) Shard{
+        Locker _locker;        /* 以下成员都只在持有锁时访问 */
+        Session** _buckets;    /* 桶数组 */
+        int _mask;             /* 桶数量减1，桶数量是2的幂 */
+        long _count;           /* 会话数量 */
+    };
+
+    static const int SHARD_NUM = 64;         /* 分片数量，2的幂 */
+    static const int INIT_BUCKETS = 64;      /* 每个分片初始的桶数量 */
+    static const int WHEEL_SLOTS = 512;      /* 时间轮的槽数，有效期内每个会话被检查约TTL/槽数次 */
+
+    static bool parse(const char* token, uint8_t* key);
+    static uint64_t hashOf(const uint8_t* key);
+    Shard* shardOf(uint64_t h){
+        return _shards + (h >> 58) % SHARD_NUM;
+    }
+    Session** slotOf(Shard* shard, uint32_t expire){
+        return _wheels[shard - _shards] + expire % WHEEL_SLOTS;
+    }
+    void grow(Shard* shard);
+    void unlink(Shard* shard, Session* session);
+    void sweep(Shard* shard, uint32_t now);
+
+    Shard _shards[SHARD_NUM];
+    Session* _wheels[SHARD_NUM][WHEEL_SLOTS];   /* 各分片的时间轮 */
+    atomic<uint32_t> _now;    /* 当前的时钟数 */
+    uint32_t _ttl;            /* 有效期对应的时钟数 */
+};
+
+#endif
@@ -0,0 +1,582 @@
+#include "usertable.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+UserTable::UserTable(){
+    for(int i=0; i<SHARD_NUM; ++i){
+        Shard* shard = _shards + i;
+        shard->_buckets.store(newBuckets(INIT_BUCKETS), memory_order_relaxed);
+        shard->_count.store(0, memory_order_relaxed);
+        shard->_freeNodes = NULL;
+        shard->_freeNum = 0;
+        shard->_arena = NULL;
+        shard->_arenaLeft = 0;
+    }
+    _sqlPool = NULL;
+    _complete.store(true, memory_order_relaxed);
+    _filter.store(NULL, memory_order_relaxed);
+    _filterReady.store(false, memory_order_relaxed);
+    _stop.store(false, memory_order_relaxed);
+    _loading = false;
+    _closeLog = 0;
+}
+
+UserTable::~UserTable(){
+    if(_loading){
+        /* 进程退出时加载线程可能仍在插入，先停止它 */
+        _stop.store(true, memory_order_relaxed);
+        pthread_join(_loader, NULL);
+    }
+    for(int i=0; i<SHARD_NUM; ++i){
+        Shard* shard = _shards + i;
+        freeBuckets(shard->_buckets.load(memory_order_relaxed));
+        for(size_t j=0; j<shard->_retired.size(); ++j){
+            freeBuckets(shard->_retired[j]);
+        }
+        for(size_t j=0; j<shard->_nodeBlocks.size(); ++j){
+            delete[] shard->_nodeBlocks[j];
+        }
+        for(size_t j=0; j<shard->_charBlocks.size(); ++j){
+            delete[] shard->_charBlocks[j];
+        }
+    }
+    delete _filter.load(memory_order_relaxed);
+}
+
+/*
+*功能：单例模式，所有连接共用一张用户表
+*/
+UserTable* UserTable::getInstance(){
+    static UserTable userTable;
+    return &userTable;
+}
+
+/*
+*功能：FNV-1a哈希，高位选分片，低位选桶
+*/
+uint64_t UserTable::hash(const char* name){
+    uint64_t h = 14695981039346656037ULL;
+    for(const unsigned char* p = (const unsigned char*)name; *p; ++p){
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+UserTable::Buckets* UserTable::newBuckets(int num){
+    Buckets* buckets = new Buckets;
+    buckets->_mask = num - 1;
+    buckets->_heads = new atomic<Node*>[num];
+    for(int i=0; i<num; ++i){
+        buckets->_heads[i].store(NULL, memory_order_relaxed);
+    }
+    return buckets;
+}
+
+void UserTable::freeBuckets(Buckets* buckets){
+    delete[] buckets->_heads;
+    delete buckets;
+}
+
+/*
+*功能：从分片的节点块中取一个节点，持有分片的锁时调用
+*/
+UserTable::Node* UserTable::newNode(Shard* shard){
+    if(shard->_freeNum == 0){
+        shard->_freeNodes = new Node[NODE_BLOCK];
+        shard->_freeNum = NODE_BLOCK;
+        shard->_nodeBlocks.push_back(shard->_freeNodes);
+    }
+    shard->_freeNum--;
+    return shard->_freeNodes++;
+}
+
+/*
+*功能：从分片的字符块中取len个字节，持有分片的锁时调用。超过字符块大小的单独分配
+*/
+char* UserTable::newChars(Shard* shard, int len){
+    if(len > CHAR_BLOCK){
+        char* chars = new char[len];
+        shard->_charBlocks.push_back(chars);
+        return chars;
+    }
+    if(shard->_arenaLeft < len){
+        shard->_arena = new char[CHAR_BLOCK];
+        shard->_arenaLeft = CHAR_BLOCK;
+        shard->_charBlocks.push_back(shard->_arena);
+    }
+    char* chars = shard->_arena;
+    shard->_arena += len;
+    shard->_arenaLeft -= len;
+    return chars;
+}
+
+/*
+*功能：分片的用户数超过桶数量时，桶数量加倍。新建桶数组和节点后一次发布，
+*     旧的桶数组和节点不修改，持有锁时调用
+*/
+void UserTable::grow(Shard* shard){
+    Buckets* old = shard->_buckets.load(memory_order_relaxed);
+    int num = (old->_mask + 1) * 2;
+    Buckets* buckets = newBuckets(num);
+    for(int i=0; i<=old->_mask; ++i){
+        for(Node* node = old->_heads[i].load(memory_order_relaxed); node; node = node->_next){
+            atomic<Node*>& head = buckets->_heads[node->_hash & buckets->_mask];
+            if(node->_snapshot && match(head.load(memory_order_relaxed), node->_hash, node->_name)){
+                /* 被同名节点覆盖的快照节点不再复制。覆盖它的节点在旧链表中靠前，已经复制过，
+                   新链表中每个用户名只有一个节点，先后顺序不再重要 */
+                continue;
+            }
+            Node* copy = newNode(shard);
+            *copy = *node;
+            copy->_next = head.load(memory_order_relaxed);
+            head.store(copy, memory_order_relaxed);
+        }
+    }
+    /* 发布新的桶数组，之后的查找都在新数组上进行 */
+    shard->_buckets.store(buckets, memory_order_release);
+    shard->_retired.push_back(old);
+}
+
+/*
+*功能：从node开始沿链表查找同名的节点，第一个即为有效的节点
+*/
+UserTable::Node* UserTable::match(Node* node, uint64_t h, const char* name){
+    for(; node; node = node->_next){
+        if(node->_hash == h && strcmp(node->_name, name) == 0){
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/*
+*功能：注册成功后加入用户，用户名已存在时不修改
+*参数：
+*      --name: 用户名
+*      --password: 密码
+*返回值：用户名已存在时返回false
+*/
+bool UserTable::insert(const char* name, const char* password){
+    return add(name, password, FROM_USER);
+}
+
+/*
+*功能：加入用户。已有的节点来自快照、而新用户来自数据库或者加载已经完成时，发布新节点覆盖它
+*参数：
+*      --source: 用户的来源，FROM_USER、FROM_SNAPSHOT或FROM_DATABASE
+*返回值：用户名已存在时返回false
+*/
+bool UserTable::add(const char* name, const char* password, int source){
+    uint64_t h = hash(name);
+    Shard* shard = _shards + (h >> 58) % SHARD_NUM;
+    shard->_locker.lock();
+    Buckets* buckets = shard->_buckets.load(memory_order_relaxed);
+    atomic<Node*>* head = buckets->_heads + (h & buckets->_mask);
+    Node* old = match(head->load(memory_order_relaxed), h, name);
+    if(old && !(old->_snapshot && (FROM_DATABASE == source ||
+                                   (FROM_USER == source && _complete.load(memory_order_relaxed))))){
+        shard->_locker.unlock();
+        return false;
+    }
+
+    int nameLen = strlen(name) + 1;
+    int passwordLen = strlen(password) + 1;
+    char* chars = newChars(shard, nameLen + passwordLen);
+    memcpy(chars, name, nameLen);
+    memcpy(chars + nameLen, password, passwordLen);
+    Node* node = newNode(shard);
+    node->_hash = h;
+    node->_name = chars;
+    node->_password = chars + nameLen;
+    node->_snapshot = (FROM_SNAPSHOT == source);
+    node->_next = head->load(memory_order_relaxed);
+    /* 节点初始化完成后再发布，查找的线程看到节点时一定能看到它的内容。
+       覆盖快照节点时新节点在它前面，查找先找到新节点 */
+    head->store(node, memory_order_release);
+    /* 过滤器创建之后加入的用户名，包括扫描期间注册的，都要加入过滤器 */
+    BloomFilter* filter = _filter.load(memory_order_acquire);
+    if(filter){
+        filter->add(h);
+    }
+
+    /* 覆盖时用户数不变 */
+    if(old == NULL && shard->_count.fetch_add(1, memory_order_relaxed) + 1 > buckets->_mask + 1){
+        grow(shard);
+    }
+    shard->_locker.unlock();
+    return true;
+}
+
+/*
+*功能：查找用户，不加锁。加载完成后，没有被数据库确认的快照节点视为已删除
+*/
+UserTable::Node* UserTable::lookup(const char* name){
+    uint64_t h = hash(name);
+    Shard* shard = _shards + (h >> 58) % SHARD_NUM;
+    Buckets* buckets = shard->_buckets.load(memory_order_acquire);
+    Node* node = match(buckets->_heads[h & buckets->_mask].load(memory_order_acquire), h, name);
+    if(node && node->_snapshot && _complete.load(memory_order_acquire)){
+        return NULL;
+    }
+    return node;
+}
+
+/*
+*功能：查找用户，加载完成前表中没有的再到数据库中查询
+*参数：
+*      --name: 用户名
+*      --sqlPool: 查询使用的连接池，NULL则使用加载的连接池
+*/
+UserTable::Node* UserTable::find(const char* name, SqlPool* sqlPool){
+    Node* node = lookup(name);
+    if(node == NULL && !_complete.load(memory_order_acquire)){
+        /* 过滤器判定不存在，一定不在数据库中 */
+        if(_filterReady.load(memory_order_acquire) &&
+           !_filter.load(memory_order_relaxed)->mayContain(hash(name))){
+            return NULL;
+        }
+        node = fetch(name, sqlPool ? sqlPool : _sqlPool);
+    }
+    return node;
+}
+
+/*
+*功能：加载完成前到数据库中查询一个用户，查到则加入表中
+*/
+UserTable::Node* UserTable::fetch(const char* name, SqlPool* sqlPool){
+    /* 转义后的长度最多为原长度的2倍加1 */
+    char escaped[256];
+    int len = strlen(name);
+    if(_sqlPool == NULL || len * 2 + 1 > (int)sizeof(escaped)){
+        return NULL;
+    }
+    MYSQL* conn = NULL;
+    ConnRAII mysqlCon(&conn, sqlPool);
+    if(conn == NULL){
+        return NULL;
+    }
+    mysql_real_escape_string(conn, escaped, name, len);
+    string sql = "SELECT username, passwd FROM user WHERE username = '";
+    sql += escaped;
+    sql += "'";
+    if(mysql_query(conn, sql.c_str())){
+        LOG_ERROR("SELECT user error:%s", mysql_error(conn));
+        return NULL;
+    }
+    MYSQL_RES* result = mysql_store_result(conn);
+    if(result == NULL){
+        return NULL;
+    }
+    bool found = false;
+    if(MYSQL_ROW row = mysql_fetch_row(result)){
+        add(row[0], row[1], FROM_DATABASE);
+        found = true;
+    }
+    mysql_free_result(result);
+    return found ? lookup(name) : NULL;
+}
+
+/*
+*功能：用户名是否已经注册
+*参数：
+*      --sqlPool: 加载完成前到数据库中查询使用的连接池，NULL则使用加载的连接池
+*/
+bool UserTable::contains(const char* name, SqlPool* sqlPool){
+    return find(name, sqlPool) != NULL;
+}
+
+/*
+*功能：登录校验，用户存在且密码相同
+*参数：
+*      --sqlPool: 加载完成前到数据库中查询使用的连接池，NULL则使用加载的连接池
+*/
+bool UserTable::check(const char* name, const char* password, SqlPool* sqlPool){
+    Node* node = find(name, sqlPool);
+    return node && strcmp(node->_password, password) == 0;
+}
+
+/*
+*功能：用户总数，只用于统计，各分片的计数不是同一时刻的
+*/
+long UserTable::size(){
+    long num = 0;
+    for(int i=0; i<SHARD_NUM; ++i){
+        num += _shards[i]._count.load(memory_order_relaxed);
+    }
+    return num;
+}
+
+/*
+*功能：开始加载数据库中的用户，不等待加载完成。有快照文件时先从快照加载，
+*     之后仍然从数据库加载，补上快照之后注册的用户
+*参数：
+*      --sqlPool: 连接池
+*      --snapshot: 快照文件路径，NULL或空表示不使用快照
+*/
+void UserTable::load(SqlPool* sqlPool, const char* snapshot){
+    _sqlPool = sqlPool;
+    _closeLog = sqlPool->_closeLog;
+    _complete.store(false, memory_order_release);
+    if(snapshot && *snapshot){
+        long num = loadSnapshot(snapshot);
+        if(num >= 0){
+            LOG_INFO("%ld users loaded from snapshot %s", num, snapshot);
+        }
+    }
+    if(pthread_create(&_loader, NULL, loader, this) != 0){
+        throw std::exception();
+    }
+    _loading = true;
+}
+
+void* UserTable::loader(void* arg){
+    mysql_thread_init();
+    ((UserTable*)arg)->buildFilter();
+    ((UserTable*)arg)->loadPages();
+    mysql_thread_end();
+    return NULL;
+}
+
+/*
+*功能：建立用户名的布隆过滤器。全表扫描的时间和用户数成正比，期间一直占用连接，
+*     所以使用单独建立的连接，不占用连接池(最少连接数为1时池中可能只有一个连接，登录查询要用它)
+*/
+void UserTable::buildFilter(){
+    MYSQL* conn = _sqlPool->newConnection();
+    if(conn == NULL){
+        LOG_ERROR("%s", "bloom filter: no connection");
+        return;
+    }
+    scanNames(conn);
+    mysql_close(conn);
+}
+
+/*
+*功能：按用户数量的两倍预留空间建立过滤器，只读取用户名，一次查询流式接收，
+*     比加载完整的用户快得多。出错时不使用过滤器
+*/
+void UserTable::scanNames(MYSQL* conn){
+    long users = 0;
+    if(mysql_query(conn, "SELECT COUNT(*) FROM user")){
+        LOG_ERROR("count users error:%s", mysql_error(conn));
+        return;
+    }
+    MYSQL_RES* result = mysql_store_result(conn);
+    if(result == NULL){
+        return;
+    }
+    if(MYSQL_ROW row = mysql_fetch_row(result)){
+        users = row[0] ? atol(row[0]) : 0;
+    }
+    mysql_free_result(result);
+
+    /* 先发布过滤器再扫描，扫描开始之后提交的注册不在扫描结果中，由insert()加入 */
+    BloomFilter* filter = new BloomFilter(users * 2 + LOAD_PAGE);
+    _filter.store(filter, memory_order_release);
+    if(mysql_query(conn, "SELECT username FROM user")){
+        LOG_ERROR("scan usernames error:%s", mysql_error(conn));
+        return;
+    }
+    result = mysql_use_result(conn);
+    if(result == NULL){
+        return;
+    }
+    long num = 0;
+    while(MYSQL_ROW row = mysql_fetch_row(result)){
+        if(_stop.load(memory_order_relaxed)){
+            mysql_free_result(result);
+            return;
+        }
+        filter->add(hash(row[0]));
+        ++num;
+    }
+    bool ok = (mysql_errno(conn) == 0);
+    mysql_free_result(result);
+    if(!ok){
+        LOG_ERROR("scan usernames error:%s", mysql_error(conn));
+        return;
+    }
+    _filterReady.store(true, memory_order_release);
+    LOG_INFO("bloom filter of %ld usernames, %ld bytes", num, filter->bytes());
+}
+
+/*
+*功能：加载线程，按用户名分页读取，每页用mysql_use_result边接收边插入，不缓存整个结果集；
+*     每页重新获取连接，加载期间不长期占用连接池。出错时等待一段时间后从读到的最后一个用户名继续，
+*     等待时间逐次加倍，直到加载完成或进程退出。加载完成前快照节点仍然有效，查询继续回退到数据库
+*/
+void UserTable::loadPages(){
+    string last;
+    long total = 0;
+    int backoff = 1;
+    while(!_stop.load(memory_order_relaxed)){
+        int rows = loadPage(last, total);
+        if(rows < 0){
+            LOG_WARN("load users stopped after %ld users, retry in %d s", total, backoff);
+            for(int i=0; i<backoff * 10 && !_stop.load(memory_order_relaxed); ++i){
+                usleep(100000);
+            }
+            backoff = min(backoff * 2, LOAD_RETRY_MAX);
+            continue;
+        }
+        backoff = 1;
+        if(rows < LOAD_PAGE){
+            _complete.store(true, memory_order_release);
+            LOG_INFO("%ld users loaded from database, %ld in table", total, size());
+            return;
+        }
+    }
+}
+
+/*
+*功能：读取用户名大于last的一页用户
+*参数：
+*      --last: 传入传出参数，已读到的最后一个用户名，出错时也更新到出错前读到的位置
+*      --total: 传入传出参数，已加载的用户总数
+*返回值：本页的用户数量，出错返回-1。只有没有出错且不足一页时才说明已经读完
+*/
+int UserTable::loadPage(string& last, long& total){
+    MYSQL* conn = NULL;
+    ConnRAII mysqlCon(&conn, _sqlPool);
+    if(conn == NULL){
+        LOG_ERROR("%s", "load users: no connection");
+        return -1;
+    }
+    vector<char> escaped(last.size() * 2 + 1);
+    mysql_real_escape_string(conn, escaped.data(), last.c_str(), last.size());
+    char limit[32];
+    snprintf(limit, sizeof(limit), "' ORDER BY username LIMIT %d", LOAD_PAGE);
+    string sql = "SELECT username, passwd FROM user WHERE username > '";
+    sql += escaped.data();
+    sql += limit;
+    if(mysql_query(conn, sql.c_str())){
+        LOG_ERROR("load users error:%s", mysql_error(conn));
+        return -1;
+    }
+    MYSQL_RES* result = mysql_use_result(conn);
+    if(result == NULL){
+        LOG_ERROR("load users error:%s", mysql_error(conn));
+        return -1;
+    }
+    int rows = 0;
+    while(MYSQL_ROW row = mysql_fetch_row(result)){
+        add(row[0], row[1], FROM_DATABASE);
+        last = row[0];
+        ++rows;
+        ++total;
+    }
+    /* mysql_fetch_row返回NULL也可能是接收中途出错，此时不足一页并不表示读完 */
+    bool ok = (mysql_errno(conn) == 0);
+    if(!ok){
+        LOG_ERROR("load users error:%s", mysql_error(conn));
+    }
+    mysql_free_result(result);
+    return ok ? rows : -1;
+}
+
+/*
+*功能：从快照文件加载用户。文件映射到内存后顺序读取，读完即解除映射
+*返回值：加载的用户数量，没有快照或快照无效时返回-1
+*/
+long UserTable::loadSnapshot(const char* path){
+    int fd = open(path, O_RDONLY);
+    if(fd == -1){
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(SnapshotHeader)){
+        close(fd);
+        return -1;
+    }
+    char* data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    SnapshotHeader* header = (SnapshotHeader*)data;
+    if(memcmp(header->_magic, "USERSNP1", 8) != 0 ||
+       header->_bytes != (uint64_t)st.st_size - sizeof(SnapshotHeader)){
+        LOG_ERROR("invalid user snapshot %s", path);
+        munmap(data, st.st_size);
+        return -1;
+    }
+    const char* p = data + sizeof(SnapshotHeader);
+    const char* end = data + st.st_size;
+    long num = 0;
+    for(uint64_t i=0; i<header->_count; ++i){
+        const char* password = (const char*)memchr(p, '\0', end - p);
+        if(password == NULL){
+            break;
+        }
+        ++password;
+        const char* next = (const char*)memchr(password, '\0', end - password);
+        if(next == NULL){
+            break;
+        }
+        add(p, password, FROM_SNAPSHOT);
+        p = next + 1;
+        ++num;
+    }
+    munmap(data, st.st_size);
+    return num;
+}
+
+/*
+*功能：将表中的用户写入快照文件，先写临时文件再改名，不会留下写了一半的快照
+*参数：
+*      --path: 快照文件路径
+*/
+bool UserTable::saveSnapshot(const char* path){
+    string tmp = string(path) + ".tmp";
+    /* 快照中有密码，只有服务器的用户可以读写。临时文件已存在时open不改变权限，再设置一次 */
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE* file = NULL;
+    if(fd != -1 && (fchmod(fd, 0600) != 0 || (file = fdopen(fd, "wb")) == NULL)){
+        close(fd);
+    }
+    if(file == NULL){
+        LOG_ERROR("cannot write user snapshot %s", tmp.c_str());
+        return false;
+    }
+    SnapshotHeader header;
+    memcpy(header._magic, "USERSNP1", 8);
+    header._count = 0;
+    header._bytes = 0;
+    fwrite(&header, sizeof(header), 1, file);
+    for(int i=0; i<SHARD_NUM; ++i){
+        Shard* shard = _shards + i;
+        shard->_locker.lock();
+        Buckets* buckets = shard->_buckets.load(memory_order_relaxed);
+        for(int j=0; j<=buckets->_mask; ++j){
+            for(Node* node = buckets->_heads[j].load(memory_order_relaxed); node; node = node->_next){
+                if(node->_snapshot && lookup(node->_name) != node){
+                    /* 被覆盖的或者加载完成后没有被确认的快照节点 */
+                    continue;
+                }
+                /* 密码紧接在用户名之后，一次写入 */
+                size_t len = node->_password - node->_name + strlen(node->_password) + 1;
+                fwrite(node->_name, 1, len, file);
+                header._count++;
+                header._bytes += len;
+            }
+        }
+        shard->_locker.unlock();
+    }
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    bool ok = (fflush(file) == 0 && fsync(fileno(file)) == 0);
+    ok = (fclose(file) == 0) && ok;
+    if(!ok || rename(tmp.c_str(), path) != 0){
+        LOG_ERROR("cannot write user snapshot %s", path);
+        unlink(tmp.c_str());
+        return false;
+    }
+    LOG_INFO("%ld users saved to snapshot %s", (long)header._count, path);
+    return true;
+}
@@ -0,0 +1,128 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-20
+@Detail    : 用户表，分片的并发哈希表，登录查找不加锁，注册只锁一个分片。
+             启动时在后台分页加载数据库中的用户，也可以先从上次退出时保存的快照加载
+@Reference : https://www.kernel.org/doc/html/latest/RCU/whatisRCU.html
+*/
+
+#ifndef USERTABLE_H
+#define USERTABLE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include "../locker/locker.h"
+#include "../mysql/sqlpool.h"
+#include "../log/log.h"
+#include "bloomfilter.h"
+using namespace std;
+
+/* 后台加载时每页的用户数量 */
+const int LOAD_PAGE = 10000;
+/* 加载出错后重试的最长间隔，单位s */
+const int LOAD_RETRY_MAX = 60;
+
+/* 快照文件头，之后是count个"用户名\0密码\0" */
+struct SnapshotHeader{
+    char _magic[8];    /* "USERSNP1" */
+    uint64_t _count;   /* 用户数量 */
+    uint64_t _bytes;   /* 头之后的字节数 */
+};
+
+/* 用户表类：用户只增不删，按用户名的哈希分到SHARD_NUM个分片。
+   每个分片是一张链式哈希表，节点发布后不再修改，插入时锁分片、把新节点用release写入桶头，
+   查找时用acquire读取分片当前的桶数组和桶头，沿链表比较，不加锁也不会读到未初始化的节点。
+   扩容时新建桶数组和链表节点(用户名和密码不复制)，发布新数组后旧的数组和节点留到析构时释放，
+   正在旧数组上查找的线程仍然可以安全地读完。各次扩容的大小成倍增长，保留的旧数组不超过当前大小。
+   load()后服务器立即开始服务：加载线程用mysql_use_result按用户名分页流式读取，
+   加载完成前表中查不到的用户名再到数据库中单独查询一次。
+   加载线程先用单独建立的连接只读取用户名建立布隆过滤器，建好后过滤器判定不存在的用户名不再查询数据库，
+   注册的重名检查直接插入、不存在用户的登录直接失败。
+   快照中的用户只在加载完成前暂时有效：从数据库读到同名用户时在桶头发布新节点，覆盖快照的节点；
+   加载完成后没有被数据库确认的快照节点视为已删除，查找不到，也不再写入快照 */
+class UserTable{
+public:
+    static UserTable* getInstance();
+    bool insert(const char* name, const char* password);
+    bool contains(const char* name, SqlPool* sqlPool = NULL);
+    bool check(const char* name, const char* password, SqlPool* sqlPool = NULL);
+    long size();
+    void load(SqlPool* sqlPool, const char* snapshot);
+    bool saveSnapshot(const char* path);
+
+private:
+    UserTable();
+    ~UserTable();
+
+    /* 链表节点，发布后只读 */
+    struct Node{
+        uint64_t _hash;       /* 用户名的哈希值 */
+        const char* _name;    /* 用户名，后面紧接着密码 */
+        const char* _password;
+        bool _snapshot;       /* 是否来自快照，还没有被数据库确认 */
+        Node* _next;
+    };
+    /* 用户的来源 */
+    enum SOURCE{
+        FROM_USER = 0,    /* 注册 */
+        FROM_SNAPSHOT,    /* 快照 */
+        FROM_DATABASE     /* 数据库 */
+    };
+    /* 一个分片的桶数组 */
+    struct Buckets{
+        int _mask;               /* 桶数量减1，桶数量是2的幂 */
+        atomic<Node*>* _heads;   /* 各个桶的链表头 */
+    };
+    /* 分片，按缓存行对齐，不同分片的锁不在同一缓存行 */
+    struct alignas(64) Shard{
+        atomic<Buckets*> _buckets;    /* 当前的桶数组 */
+        atomic<long> _count;          /* 用户数量，只在持有锁时增加 */
+        Locker _locker;               /* 插入和扩容时加锁，以下成员都只在持有锁时修改 */
+        Node* _freeNodes;             /* 当前节点块中未使用的节点 */
+        int _freeNum;                 /* 未使用的节点数量 */
+        char* _arena;                 /* 当前字符块中未使用的部分，存放用户名和密码 */
+        int _arenaLeft;               /* 未使用的字节数 */
+        vector<Node*> _nodeBlocks;    /* 分配的节点块，析构时释放 */
+        vector<char*> _charBlocks;    /* 分配的字符块，析构时释放 */
+        vector<Buckets*> _retired;    /* 扩容替换下的桶数组 */
+    };
+
+    static const int SHARD_NUM = 64;          /* 分片数量，2的幂 */
+    static const int INIT_BUCKETS = 64;       /* 每个分片初始的桶数量 */
+    static const int NODE_BLOCK = 256;        /* 每次分配的节点数量 */
+    static const int CHAR_BLOCK = 16384;      /* 每次分配的字符块大小 */
+
+    static uint64_t hash(const char* name);
+    bool add(const char* name, const char* password, int source);
+    static Node* match(Node* node, uint64_t h, const char* name);
+    Node* lookup(const char* name);
+    static Buckets* newBuckets(int num);
+    void grow(Shard* shard);
+    static void freeBuckets(Buckets* buckets);
+    Node* newNode(Shard* shard);
+    char* newChars(Shard* shard, int len);
+    Node* find(const char* name, SqlPool* sqlPool);
+    Node* fetch(const char* name, SqlPool* sqlPool);
+    long loadSnapshot(const char* path);
+    static void* loader(void* arg);
+    void buildFilter();
+    void scanNames(MYSQL* conn);
+    void loadPages();
+    int loadPage(string& last, long& total);
+
+    Shard _shards[SHARD_NUM];
+    SqlPool* _sqlPool;          /* 加载使用的连接池，也是单独查询默认使用的连接池，NULL表示没有数据库 */
+    atomic<bool> _complete;     /* 是否已经加载了数据库中的全部用户 */
+    atomic<BloomFilter*> _filter;   /* 用户名的布隆过滤器，NULL表示尚未创建 */
+    atomic<bool> _filterReady;      /* 过滤器是否已经包含数据库中的全部用户名 */
+    atomic<bool> _stop;         /* 进程退出，停止加载线程 */
+    pthread_t _loader;          /* 加载线程 */
+    bool _loading;              /* 是否创建了加载线程 */
+    int _closeLog;              /* 日志开关 */
+};
+
+#endif
@@ -0,0 +1,46 @@
+#!/bin/bash
+# 异步查询(-g)对真实MariaDB服务器的测试
+# 用法：在项目根目录执行 make testserver MARIADB=1 && ./test/asyncsql.sh
+# 检查：
+#   1. 并发注册全部成功，全部写入数据库，且确实走了异步连接(日志中没有async sql disabled)
+#   2. 在数据库端杀掉异步连接后，连接被修好，之后的注册仍然成功
+#   3. 重复注册被拒绝，注册的用户可以登录
+
+source $(dirname $0)/mariadb.sh
+
+COUNT=${COUNT:-200}
+
+db_start primary 127.0.0.2
+server_start -c 0 -e 127.0.0.2 -g 2 -i 1
+
+register(){
+    for i in $(seq $1 $2); do
+        echo "$(post /3CGISQL.cgi async$i pw$i)" &
+        if (( i % 20 == 0 )); then
+            wait
+        fi
+    done
+    wait
+}
+
+ok=$(register 1 $COUNT | grep -c "Sign in")
+[ "$ok" -eq $COUNT ] || fail "$ok of $COUNT registrations succeeded"
+rows=$(db_sql primary "SELECT COUNT(*) FROM $DB_NAME.user WHERE username LIKE 'async%'")
+[ "$rows" -eq $COUNT ] || fail "$rows rows in the database, expected $COUNT"
+server_log | grep -q "async sql disabled" && fail "async sql was disabled"
+
+# 杀掉服务器的全部数据库连接，包括异步连接，之后的注册应在连接修好后成功
+db_sql primary "SELECT CONCAT('KILL ', id, ';') FROM information_schema.processlist WHERE user = '$DB_USER'" \
+    > $WORK/kill.sql
+db_sql primary "$(cat $WORK/kill.sql)"
+sleep 2
+ok=$(register $((COUNT + 1)) $((COUNT * 2)) | grep -c "Sign in")
+rows=$(db_sql primary "SELECT COUNT(*) FROM $DB_NAME.user WHERE username LIKE 'async%'")
+[ "$rows" -eq $((COUNT * 2)) ] || fail "$rows rows after killing the connections, expected $((COUNT * 2))"
+[ "$ok" -eq $COUNT ] || fail "$ok of $COUNT registrations succeeded after killing the connections"
+
+[ "$(post /3CGISQL.cgi async1 pw1)" == "Sign up" ] || fail "duplicate registration accepted"
+[ "$(post /2CGISQL.cgi async1 pw1)" == "WebServer" ] || fail "login after registration failed"
+
+server_stop
+echo "PASS"
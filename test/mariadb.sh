@@ -0,0 +1,103 @@
+# 测试脚本共用的函数，用source引入，不单独执行。
+# 在临时目录中启动一次性的mariadbd实例，每个实例绑定一个回环地址(如127.0.0.2)的3306端口，
+# 服务器的-e/-j参数只接受主机名，端口固定为3306，所以用不同的地址区分实例。
+# 需要: mariadb-server(mariadbd、mariadb-install-db、mariadb客户端)，curl，
+#       以及用make testserver编译的./testserver，在项目根目录执行。
+
+TOP=$(pwd)
+WORK=$(mktemp -d /tmp/webserver-test.XXXXXX)
+PORT=${PORT:-9190}
+export DB_USER=webserver DB_PASSWORD=webserver DB_NAME=yourdb
+SERVER_PID=
+DB_PIDS=
+
+pick(){
+    for name in "$@"; do
+        if command -v $name > /dev/null; then
+            echo $name
+            return
+        fi
+    done
+    echo "missing: $*" >&2
+    exit 1
+}
+MARIADBD=$(pick mariadbd mysqld)
+INSTALL_DB=$(pick mariadb-install-db mysql_install_db)
+CLIENT=$(pick mariadb mysql)
+
+cleanup(){
+    [ -n "$SERVER_PID" ] && kill $SERVER_PID 2> /dev/null
+    for pid in $DB_PIDS; do
+        kill $pid 2> /dev/null
+    done
+    wait 2> /dev/null
+    rm -rf $WORK
+}
+trap cleanup EXIT
+
+fail(){
+    echo "FAIL: $*"
+    exit 1
+}
+
+# db_start 名字 地址：初始化并启动实例，建好库、用户表和服务器使用的账号
+db_start(){
+    local dir=$WORK/$1
+    mkdir -p $dir
+    $INSTALL_DB --no-defaults --user=$(id -un) --datadir=$dir/data --auth-root-authentication-method=normal \
+        > $dir/install.log 2>&1 || fail "install $1, see $dir/install.log"
+    $MARIADBD --no-defaults --user=$(id -un) --datadir=$dir/data --bind-address=$2 --port=3306 \
+        --socket=$dir/sock --pid-file=$dir/pid --log-error=$dir/error.log --skip-name-resolve \
+        --general-log --general-log-file=$dir/general.log &
+    DB_PIDS="$DB_PIDS $!"
+    for i in $(seq 50); do
+        db_sql $1 "SELECT 1" > /dev/null 2>&1 && break
+        sleep 0.2
+    done
+    db_sql $1 "CREATE DATABASE $DB_NAME;
+        CREATE TABLE $DB_NAME.user(username CHAR(50) NOT NULL PRIMARY KEY, passwd CHAR(50) NULL);
+        CREATE USER '$DB_USER'@'%' IDENTIFIED BY '$DB_PASSWORD';
+        GRANT ALL ON $DB_NAME.* TO '$DB_USER'@'%';" || fail "setup $1, see $dir/error.log"
+}
+
+# db_log 名字：实例的general log，记录了收到的每一条语句
+db_log(){
+    cat $WORK/$1/general.log
+}
+
+# db_sql 名字 语句：以root通过socket执行，输出不带表头
+db_sql(){
+    $CLIENT --no-defaults -uroot --socket=$WORK/$1/sock -N -B -e "$2"
+}
+
+# server_start 参数...：在临时目录启动./testserver，等待端口可用
+server_start(){
+    mkdir -p $WORK/server
+    cp -r root $WORK/server/
+    (cd $WORK/server && exec $TOP/testserver -p $PORT "$@" > server.out 2>&1) &
+    SERVER_PID=$!
+    for i in $(seq 50); do
+        curl -s -o /dev/null http://127.0.0.1:$PORT/ && return
+        kill -0 $SERVER_PID 2> /dev/null || fail "server exited: $(cat $WORK/server/server.out)"
+        sleep 0.2
+    done
+    fail "server did not start"
+}
+
+server_stop(){
+    kill $SERVER_PID
+    wait $SERVER_PID 2> /dev/null
+    SERVER_PID=
+}
+
+# post 路径 用户名 密码：提交注册(/3CGISQL.cgi)或登录(/2CGISQL.cgi)表单，输出返回页面的标题
+# 注册成功和登录失败都是Sign in，注册失败是Sign up，登录成功是WebServer
+post(){
+    curl -s -m 10 -X POST -d "user=$2&password=$3" http://127.0.0.1:$PORT$1 | grep -o "<title>.*</title>" \
+        | sed 's/<[^>]*>//g'
+}
+
+# server_log：服务器的日志内容
+server_log(){
+    cat $WORK/server/*serverLog* 2> /dev/null
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+# 读写分离(-e主库，-j只读副本)的路由测试，主库和副本是两个没有复制关系的独立实例，
+# 从哪个实例读到了数据、哪个实例的general log里有语句，就说明请求发到了哪里
+# 用法：在项目根目录执行 make testserver && ./test/replica.sh
+# 检查：
+#   1. 启动时的批量加载只读副本：加载的用户数等于副本的行数，分页查询只出现在副本的日志中
+#   2. 登录读副本：只存在于副本的用户能登录，只存在于主库的用户不能
+#   3. 注册写主库：新用户只出现在主库，INSERT只出现在主库的日志中
+
+source $(dirname $0)/mariadb.sh
+
+REPLICA_USERS=25000
+
+db_start primary 127.0.0.2
+db_start replica 127.0.0.3
+db_sql primary "INSERT INTO $DB_NAME.user VALUES('onprimary', 'p1')"
+db_sql replica "INSERT INTO $DB_NAME.user VALUES('onreplica', 'r1');
+    INSERT INTO $DB_NAME.user SELECT CONCAT('bulk', seq), 'pw' FROM seq_1_to_$((REPLICA_USERS - 1))"
+
+server_start -c 0 -e 127.0.0.2 -j 127.0.0.3
+for i in $(seq 50); do
+    server_log | grep -q "users loaded from database" && break
+    sleep 0.2
+done
+loaded=$(server_log | grep -o "[0-9]* users loaded from database" | cut -d' ' -f1)
+[ "$loaded" == "$REPLICA_USERS" ] || fail "loaded '$loaded' users, expected $REPLICA_USERS from the replica"
+db_log replica | grep -q "ORDER BY username LIMIT" || fail "bulk load did not query the replica"
+db_log primary | grep -q "ORDER BY username LIMIT" && fail "bulk load queried the primary"
+
+[ "$(post /2CGISQL.cgi onreplica r1)" == "WebServer" ] || fail "replica-only user cannot log in"
+[ "$(post /2CGISQL.cgi onprimary p1)" == "Sign in" ] || fail "primary-only user logged in, login read the primary"
+
+[ "$(post /3CGISQL.cgi newuser n1)" == "Sign in" ] || fail "registration failed"
+[ "$(db_sql primary "SELECT COUNT(*) FROM $DB_NAME.user WHERE username = 'newuser'")" == 1 ] \
+    || fail "registration did not reach the primary"
+[ "$(db_sql replica "SELECT COUNT(*) FROM $DB_NAME.user WHERE username = 'newuser'")" == 0 ] \
+    || fail "registration reached the replica"
+db_log replica | grep -q "INSERT INTO user" && fail "INSERT sent to the replica"
+db_log primary | grep -q "INSERT INTO user" || fail "no INSERT on the primary"
+[ "$(post /2CGISQL.cgi newuser n1)" == "WebServer" ] || fail "new user cannot log in"
+
+server_stop
+echo "PASS"
@@ -0,0 +1,34 @@
+/*
+@Author    : Raojunjie
+@Date      : 2022-8-20
+@Detail    : 测试用的服务器入口，和main.cpp相同但不转入后台，数据库的登录名、密码和库名从环境变量
+             DB_USER、DB_PASSWORD、DB_NAME读取，供test目录下的脚本连接临时启动的数据库实例
+*/
+
+#include "../source/server/webserver.h"
+#include <stdlib.h>
+#include <string>
+using namespace std;
+
+/*
+*功能：读取环境变量，未设置时返回默认值
+*/
+static string env(const char* name, const char* defaultValue){
+    const char* value = getenv(name);
+    return value ? value : defaultValue;
+}
+
+int main(int argc, char* argv[]){
+    WebServer server;
+    server.setSql(env("DB_USER", "webserver"), env("DB_PASSWORD", "webserver"), env("DB_NAME", "yourdb"));
+    server.parseArgs(argc, argv);
+
+    server.logWrite();
+    server.sqlPool();
+    server.threadPool();
+    server.trigMode();
+    server.eventListen();
+    server.eventLoop();
+
+    return 0;
+}